@@ -1 +1,495 @@
 #!/usr/bin/env node
+import fs from 'fs';
+import os from 'os';
+import path from 'path';
+
+import { DB, DBFiles, DB_VALUE_MAX_SIZE } from './db';
+
+const USAGE = `Usage:
+  insta-db import <dir|file.tar> [options]
+  insta-db export <manifest> <dir> [options]
+
+Options:
+  --db <file>          storage file (default: insta.db)
+  --size <bytes>       storage file size, accepts k/m/g suffixes
+                       (default: that of an existing --db, else 1g)
+  --copy <file>        storage copy, may be repeated
+  --read-only <file>   read-only storage file, may be repeated
+  --data <file>        data file for large chunks (split layout), may be repeated
+  --data-size <bytes>  data file size, accepts k/m/g suffixes (default: --size)
+  --copy-data <file>   data file of the preceding --copy, may be repeated
+  --read-only-data <file>
+                       data file of the preceding --read-only, may be repeated
+  --pin-index          lock the storage file in memory
+  --jobs <n>           worker threads (default: ${os.cpus().length})
+  --batch <bytes>      bytes hashed and compressed per batch (default: 16m)
+  --manifest <file>    import manifest (default: <db>.manifest)
+  --content-addressing key files by the BLAKE3 hash of their content
+  --verify <mode>      recheck hashes on export: none, sampled or full
+  --quiet              no progress reporting
+
+Each manifest line is "<hash>\\t<size>\\t<path>". Importing into an existing
+manifest resumes: every file is hashed again, but content the database
+already has is not stored twice, and files whose path and hash are already
+listed are skipped. A changed file gets a new line, and the last line for a
+path wins. Files larger than the database's value limit (about 64 MiB) are
+reported and skipped. Exporting writes every manifest entry to <dir>/<path>.
+`;
+
+interface CLIOptions {
+    db: string;
+    size?: number;
+    copies: DBFiles[];
+    rocopies: DBFiles[];
+    data: string[];
+    data_size?: number;
+    pin_index: boolean;
+    jobs: number;
+    batch: number;
+    manifest?: string;
+    content_addressing: boolean;
+    verify: 'none'|'full'|'sampled';
+    quiet: boolean;
+    args: string[];
+}
+
+interface ImportEntry {
+    name: string;
+    data: Buffer|Promise<Buffer>;
+}
+
+function parseBytes(value: string): number
+{
+    const match = String(value).match(/^(\d+)([kmgt]?)i?b?$/i);
+    if (!match) {
+        throw new Error(`Invalid size: ${value}`);
+    }
+    return Number(match[1]) * 1024 ** ' kmgt'.indexOf(match[2].toLowerCase() || ' ');
+}
+
+function formatBytes(bytes: number): string
+{
+    const units = [ 'B', 'KiB', 'MiB', 'GiB', 'TiB' ];
+    let unit = 0;
+    while (bytes >= 1024 && unit < units.length - 1) {
+        bytes /= 1024;
+        ++unit;
+    }
+    return `${bytes.toFixed(unit ? 1 : 0)} ${units[unit]}`;
+}
+
+function parseArgs(argv: string[]): CLIOptions
+{
+    const opts: CLIOptions = {
+        db : 'insta.db',
+        copies : [],
+        rocopies : [],
+        data : [],
+        pin_index : false,
+        jobs : os.cpus().length,
+        batch : parseBytes('16m'),
+        content_addressing : false,
+        verify : 'none',
+        quiet : false,
+        args : [],
+    };
+    for (let i = 0; i < argv.length; ++i) {
+        const arg = argv[i];
+        const next = () => {
+            if (i + 1 >= argv.length) {
+                throw new Error(`${arg} requires a value`);
+            }
+            return argv[++i];
+        };
+        switch (arg) {
+        case '--db':
+            opts.db = next();
+            break;
+        case '--size':
+            opts.size = parseBytes(next());
+            break;
+        case '--copy':
+            opts.copies.push({ storage_file : next(), data_files : [] });
+            break;
+        case '--read-only':
+            opts.rocopies.push({ storage_file : next(), data_files : [] });
+            break;
+        case '--data':
+            opts.data.push(next());
+            break;
+        case '--data-size':
+            opts.data_size = parseBytes(next());
+            break;
+        case '--copy-data':
+        case '--read-only-data': {
+            const files = arg === '--copy-data' ? opts.copies : opts.rocopies;
+            if (!files.length) {
+                throw new Error(`${arg} must follow ${arg.slice(0, -5)}`);
+            }
+            files[files.length - 1].data_files!.push(next());
+            break;
+        }
+        case '--pin-index':
+            opts.pin_index = true;
+            break;
+        case '--jobs':
+            opts.jobs = Math.max(1, Number(next()) | 0);
+            break;
+        case '--batch':
+            opts.batch = Math.max(1, parseBytes(next()));
+            break;
+        case '--manifest':
+            opts.manifest = next();
+            break;
+        case '--content-addressing':
+            opts.content_addressing = true;
+            break;
+        case '--verify': {
+            const mode = next();
+            if (mode !== 'none' && mode !== 'full' && mode !== 'sampled') {
+                throw new Error(`Invalid verify mode: ${mode}`);
+            }
+            opts.verify = mode;
+            break;
+        }
+        case '--quiet':
+            opts.quiet = true;
+            break;
+        default:
+            if (arg.startsWith('--')) {
+                throw new Error(`Unknown option: ${arg}`);
+            }
+            opts.args.push(arg);
+        }
+    }
+    return opts;
+}
+
+class Progress
+{
+    files = 0;
+    bytes = 0;
+    skipped = 0;
+    private start = Date.now();
+    private last = 0;
+
+    constructor(private verb: string, private quiet: boolean) {}
+
+    report(final = false)
+    {
+        const now = Date.now();
+        if (this.quiet || (!final && (!process.stderr.isTTY || now - this.last < 250))) {
+            return;
+        }
+        this.last = now;
+        const seconds = Math.max(now - this.start, 1) / 1000;
+        process.stderr.write(
+            `\r${this.verb} ${this.files} files, ${formatBytes(this.bytes)} (${
+                formatBytes(this.bytes / seconds)}/s)${
+                this.skipped ? `, ${this.skipped} skipped` : ''}${
+                final ? ` in ${seconds.toFixed(1)}s\n` : '\x1b[K'}`);
+    }
+}
+
+async function* walkDirectory(root: string, dir = ''): AsyncGenerator<string>
+{
+    const handle = await fs.promises.opendir(path.join(root, dir));
+    for await (const dirent of handle) {
+        const name = dir ? `${dir}/${dirent.name}` : dirent.name;
+        if (dirent.isDirectory()) {
+            yield* walkDirectory(root, name);
+        } else if (dirent.isFile()) {
+            yield name;
+        }
+    }
+}
+
+async function* readDirectory(root: string): AsyncGenerator<ImportEntry>
+{
+    for await (const name of walkDirectory(root)) {
+        const file = path.join(root, name);
+        const data = fs.promises.readFile(file).catch((error: NodeJS.ErrnoException) => {
+            throw new Error(`Could not read ${file}: ${error.code || error.message}`);
+        });
+        // reads are queued ahead of take(), which reports the failure; until then it is not unhandled
+        data.catch(() => {});
+        yield { name, data };
+    }
+}
+
+function tarString(header: Buffer, offset: number, length: number): string
+{
+    const field = header.subarray(offset, offset + length);
+    const end = field.indexOf(0);
+    return field.subarray(0, end < 0 ? length : end).toString('utf8');
+}
+
+function tarNumber(header: Buffer, offset: number, length: number): number
+{
+    if (header[offset] & 0x80) {
+        // GNU base-256 encoding
+        let value = header[offset] & 0x7f;
+        for (let i = 1; i < length; ++i) {
+            value = value * 256 + header[offset + i];
+        }
+        return value;
+    }
+    return parseInt(tarString(header, offset, length).trim() || '0', 8);
+}
+
+async function* readTar(file: string): AsyncGenerator<ImportEntry>
+{
+    const stream = fs.createReadStream(file, { highWaterMark : 1 << 20 });
+    const reader = stream[Symbol.asyncIterator]();
+    const pending: Buffer[] = [];
+    let available = 0;
+
+    async function read(length: number): Promise<Buffer|undefined>
+    {
+        while (available < length) {
+            const { value, done } = await reader.next();
+            if (done) {
+                return undefined;
+            }
+            pending.push(value);
+            available += value.length;
+        }
+        const joined = pending.length === 1 ? pending[0] : Buffer.concat(pending);
+        pending.length = 0;
+        if (joined.length > length) {
+            pending.push(joined.subarray(length));
+        }
+        available -= length;
+        return joined.subarray(0, length);
+    }
+
+    let longName: string|undefined;
+
+    for (;;) {
+        const header = await read(512);
+        if (!header || header.every((byte) => byte === 0)) {
+            break;
+        }
+        const size = tarNumber(header, 124, 12);
+        const type = String.fromCharCode(header[156] || 0x30);
+        const data = await read(size);
+        if (!data || !(await read((512 - (size % 512)) % 512))) {
+            throw new Error(`${file}: unexpected end of archive`);
+        }
+        if (type === 'L') {
+            longName = tarString(data, 0, data.length);
+        } else if (type === 'x') {
+            const match = data.toString('utf8').match(/^\d+ path=(.*)$/m);
+            longName = match ? match[1] : longName;
+        } else if (type === '0' || type === '7') {
+            let name = longName;
+            if (name === undefined) {
+                const prefix = header.toString('latin1', 257, 262) === 'ustar' ? tarString(header, 345, 155) : '';
+                name = prefix ? `${prefix}/${tarString(header, 0, 100)}` : tarString(header, 0, 100);
+            }
+            longName = undefined;
+            // copy, so that the whole read-ahead block is not retained
+            yield { name, data : Buffer.from(data) };
+        } else {
+            longName = undefined;
+        }
+    }
+
+    stream.destroy();
+}
+
+/** The latest entry for each path; re-imports append a new line when a file changes. */
+function readManifest(file: string): [ string, number, string ][]
+{
+    if (!fs.existsSync(file)) {
+        return [];
+    }
+    const entries = new Map<string, [ string, number, string ]>();
+    for (const line of fs.readFileSync(file, 'utf8').split('\n')) {
+        const [ hash, size, ...name ] = line.split('\t');
+        if (name.length && (hash.length === 64 || size === '0')) {
+            entries.set(name.join('\t'), [ hash, Number(size), name.join('\t') ]);
+        }
+    }
+    return [ ...entries.values() ];
+}
+
+function openDB(opts: CLIOptions): DB
+{
+    // the whole file is mapped for writing, so an existing database cannot be opened smaller
+    const existing = fs.existsSync(opts.db) ? fs.statSync(opts.db).size : 0;
+    if (opts.size !== undefined && opts.size < existing) {
+        throw new Error(`--size ${opts.size} is smaller than ${opts.db} (${existing} bytes)`);
+    }
+    return new DB({
+        storage_file : opts.db,
+        size : opts.size ?? (existing || parseBytes('1g')),
+        storage_copies : opts.copies,
+        read_only_files : opts.rocopies,
+        data_files : opts.data,
+        data_size : opts.data_size,
+        pin_index : opts.pin_index,
+        content_addressing : opts.content_addressing,
+        verify : opts.verify,
+        threads : opts.jobs,
+    });
+}
+
+async function importCommand(opts: CLIOptions)
+{
+    const [ source ] = opts.args;
+    if (!source) {
+        throw new Error(USAGE);
+    }
+
+    const db = openDB(opts);
+    const manifestFile = opts.manifest || `${opts.db}.manifest`;
+    const progress = new Progress('imported', opts.quiet);
+
+    // resume: every file is read again, and storeMany() dedups what the database already
+    // has by hash; only paths whose hash is new or changed get a manifest line
+    const recorded = new Map<string, string>();
+    for (const [ hash, , name ] of readManifest(manifestFile)) {
+        recorded.set(name, hash);
+    }
+
+    const manifest = fs.createWriteStream(manifestFile, { flags : 'a' });
+    const entries = (await fs.promises.stat(source)).isDirectory()
+        ? readDirectory(source)
+        : readTar(source);
+
+    // the previous batch compresses on the native threads while the next one is read
+    let inflight: Promise<void> = Promise.resolve();
+    let names: string[] = [];
+    let values: Buffer[] = [];
+    let batchBytes = 0;
+
+    const flush = async () => {
+        const batchNames = names;
+        const batchValues = values;
+        names = [];
+        values = [];
+        batchBytes = 0;
+        await inflight;
+        inflight = db.storeMany(batchValues, opts.jobs).then((hashes) => {
+            let lines = '';
+            hashes.forEach((hash, i) => {
+                if (recorded.get(batchNames[i]) === hash) {
+                    ++progress.skipped;
+                    return;
+                }
+                recorded.set(batchNames[i], hash);
+                lines += `${hash}\t${batchValues[i].length}\t${batchNames[i]}\n`;
+                ++progress.files;
+                progress.bytes += batchValues[i].length;
+            });
+            manifest.write(lines);
+            progress.report();
+        });
+    };
+
+    const reading: ImportEntry[] = [];
+    const take = async (entry: ImportEntry) => {
+        const data = await entry.data;
+        if (data.length > DB_VALUE_MAX_SIZE) {
+            process.stderr.write(`\ntoo large for the database (${formatBytes(data.length)}): ${entry.name}\n`);
+            ++progress.skipped;
+            process.exitCode = 1;
+            return;
+        }
+        names.push(entry.name);
+        values.push(data);
+        batchBytes += data.length;
+        if (batchBytes >= opts.batch) {
+            await flush();
+        }
+    };
+
+    try {
+        for await (const entry of entries) {
+            reading.push(entry);
+            if (reading.length >= opts.jobs * 4) {
+                await take(reading.shift() as ImportEntry);
+            }
+        }
+        while (reading.length) {
+            await take(reading.shift() as ImportEntry);
+        }
+        await flush();
+        await inflight;
+    } finally {
+        // keep what was stored before a failure, so that the next run resumes from there
+        await inflight.catch(() => {});
+        await new Promise((resolve) => manifest.end(resolve));
+    }
+    progress.report(true);
+}
+
+async function exportCommand(opts: CLIOptions)
+{
+    const [ manifestFile, target ] = opts.args;
+    if (!manifestFile || !target) {
+        throw new Error(USAGE);
+    }
+
+    const db = openDB(opts);
+    const entries = readManifest(manifestFile);
+    const progress = new Progress('exported', opts.quiet);
+    const root = path.resolve(target);
+
+    let next = 0;
+    const worker = async () => {
+        while (next < entries.length) {
+            const [ hash, size, name ] = entries[next++];
+            const file = path.resolve(root, name);
+            if (!file.startsWith(root + path.sep)) {
+                process.stderr.write(`\nrefusing to write outside of ${root}: ${name}\n`);
+                ++progress.skipped;
+                continue;
+            }
+            let data: Buffer|undefined;
+            try {
+                data = size ? db.fetch(hash) : Buffer.alloc(0);
+            } catch (error) {
+                process.stderr.write(`\n${error instanceof Error ? error.message : error}: ${hash} ${name}\n`);
+                ++progress.skipped;
+                continue;
+            }
+            if (!data) {
+                process.stderr.write(`\nmissing from database: ${hash} ${name}\n`);
+                ++progress.skipped;
+                continue;
+            }
+            await fs.promises.mkdir(path.dirname(file), { recursive : true });
+            await fs.promises.writeFile(file, data);
+            ++progress.files;
+            progress.bytes += data.length;
+            progress.report();
+        }
+    };
+
+    await Promise.all(Array.from({ length : opts.jobs }, worker));
+    progress.report(true);
+    if (progress.skipped) {
+        process.exitCode = 1;
+    }
+}
+
+async function main(argv: string[])
+{
+    const [ command, ...rest ] = argv;
+    const opts = parseArgs(rest);
+    if (command === 'import') {
+        await importCommand(opts);
+    } else if (command === 'export') {
+        await exportCommand(opts);
+    } else {
+        process.stdout.write(USAGE);
+        process.exitCode = command && command !== 'help' && command !== '--help' ? 1 : 0;
+    }
+}
+
+main(process.argv.slice(2)).catch((error) => {
+    process.stderr.write(`${error instanceof Error ? error.message : error}\n`);
+    process.exitCode = 1;
+});
@@ -3,21 +3,231 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <node_api.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/random.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 void blake3_hash(const void* data, const size_t len, uint8_t hash[BLAKE3_OUT_LEN])
 {
-    static blake3_hasher hasher;
+    blake3_hasher hasher;
     blake3_hasher_init(&hasher);
     blake3_hasher_update(&hasher, data, len);
     blake3_hasher_finalize(&hasher, hash, BLAKE3_OUT_LEN);
 }
 
+typedef struct parallel_for {
+    void (*fn)(void* ctx, uint32_t i);
+    void* ctx;
+    uint32_t count;
+    uint32_t next;
+} parallel_for_t;
+
+void* parallel_for_worker_f(void* job_ptr)
+{
+    parallel_for_t* job = (parallel_for_t*)job_ptr;
+    uint32_t i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        job->fn(job->ctx, i);
+    }
+    return nullptr;
+}
+
+// runs fn(ctx, i) for every i < count on up to jobs threads, the calling one included
+void parallel_for_f(uint32_t jobs, uint32_t count, void (*fn)(void* ctx, uint32_t i), void* ctx)
+{
+    parallel_for_t job = { fn, ctx, count, 0 };
+
+    if (jobs > count) {
+        jobs = count;
+    }
+
+    pthread_t* threads = jobs > 1 ? (pthread_t*)calloc(jobs - 1, sizeof(pthread_t)) : nullptr;
+    uint32_t started = 0;
+
+    for (uint32_t i = 1; (threads != nullptr) && (i < jobs); ++i) {
+        if (!pthread_create(threads + started, nullptr, parallel_for_worker_f, (void*)&job)) {
+            ++started;
+        }
+    }
+
+    parallel_for_worker_f((void*)&job);
+
+    for (uint32_t i = 0; i < started; ++i) {
+        pthread_join(threads[i], nullptr);
+    }
+
+    free((void*)threads);
+}
+
+#ifndef BLAKE3_IMPL_H
+// not in blake3.h, but exported by libblake3.a; hash_many dispatches to the best SIMD backend
+extern "C" {
+void blake3_compress_in_place(uint32_t cv[8], const uint8_t block[BLAKE3_BLOCK_LEN], uint8_t block_len, uint64_t counter, uint8_t flags);
+void blake3_hash_many(const uint8_t* const* inputs, size_t num_inputs, size_t blocks, const uint32_t key[8], uint64_t counter, bool increment_counter, uint8_t flags, uint8_t flags_start, uint8_t flags_end, uint8_t* out);
+}
+#endif
+
+#define BLAKE3_FLAG_CHUNK_START 1
+#define BLAKE3_FLAG_CHUNK_END 2
+#define BLAKE3_FLAG_PARENT 4
+#define BLAKE3_FLAG_ROOT 8
+// inputs are split into groups of this many chunks, one group per task
+#define BLAKE3_GROUP_CHUNKS 256
+#define BLAKE3_GROUP_BYTES (BLAKE3_GROUP_CHUNKS * BLAKE3_CHUNK_LEN)
+// below this, one thread is faster than handing out groups
+#define BLAKE3_PARALLEL_MIN_BYTES (BLAKE3_GROUP_BYTES * 4)
+
+void blake3_store_cv_f(const uint32_t cv[8], uint8_t out[BLAKE3_OUT_LEN])
+{
+    for (int i = 0; i < 8; ++i) {
+        out[(i << 2) + 0] = (uint8_t)(cv[i] >> 0);
+        out[(i << 2) + 1] = (uint8_t)(cv[i] >> 8);
+        out[(i << 2) + 2] = (uint8_t)(cv[i] >> 16);
+        out[(i << 2) + 3] = (uint8_t)(cv[i] >> 24);
+    }
+}
+
+void blake3_parent_cv_f(const uint32_t key[8], const uint8_t left[BLAKE3_OUT_LEN], const uint8_t right[BLAKE3_OUT_LEN], uint8_t flags, uint8_t out[BLAKE3_OUT_LEN])
+{
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    uint32_t cv[8];
+    memcpy(block, left, BLAKE3_OUT_LEN);
+    memcpy(block + BLAKE3_OUT_LEN, right, BLAKE3_OUT_LEN);
+    memcpy(cv, key, sizeof(cv));
+    blake3_compress_in_place(cv, block, BLAKE3_BLOCK_LEN, 0, BLAKE3_FLAG_PARENT | flags);
+    blake3_store_cv_f(cv, out);
+}
+
+// chaining value of a single, possibly partial, non-root chunk
+void blake3_chunk_cv_f(const uint32_t key[8], const uint8_t* input, size_t len, uint64_t counter, uint8_t out[BLAKE3_OUT_LEN])
+{
+    uint32_t cv[8];
+    memcpy(cv, key, sizeof(cv));
+    size_t blocks = len ? ((len - 1) / BLAKE3_BLOCK_LEN) + 1 : 1;
+    for (size_t b = 0; b < blocks; ++b) {
+        uint8_t block[BLAKE3_BLOCK_LEN] = { 0 };
+        size_t block_len = len - b * BLAKE3_BLOCK_LEN;
+        if (block_len > BLAKE3_BLOCK_LEN) {
+            block_len = BLAKE3_BLOCK_LEN;
+        }
+        memcpy(block, input + b * BLAKE3_BLOCK_LEN, block_len);
+        uint8_t flags = (b == 0 ? BLAKE3_FLAG_CHUNK_START : 0) | (b + 1 == blocks ? BLAKE3_FLAG_CHUNK_END : 0);
+        blake3_compress_in_place(cv, block, (uint8_t)block_len, counter, flags);
+    }
+    blake3_store_cv_f(cv, out);
+}
+
+// chaining value of a non-root subtree of chunks whole chunks, chunks being a power of two <= BLAKE3_GROUP_CHUNKS
+void blake3_wide_cv_f(const uint32_t key[8], const uint8_t* input, size_t chunks, uint64_t counter, uint8_t out[BLAKE3_OUT_LEN])
+{
+    const uint8_t* inputs[BLAKE3_GROUP_CHUNKS] = {};
+    uint8_t cvs[2][BLAKE3_GROUP_CHUNKS * BLAKE3_OUT_LEN];
+    int level = 0;
+
+    for (size_t i = 0; i < chunks; ++i) {
+        inputs[i] = input + i * BLAKE3_CHUNK_LEN;
+    }
+    blake3_hash_many(inputs, chunks, BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN, key, counter, true, 0, BLAKE3_FLAG_CHUNK_START, BLAKE3_FLAG_CHUNK_END, cvs[level]);
+
+    for (; chunks > 1; chunks >>= 1, level ^= 1) {
+        for (size_t i = 0; i < (chunks >> 1); ++i) {
+            inputs[i] = cvs[level] + i * BLAKE3_BLOCK_LEN;
+        }
+        blake3_hash_many(inputs, chunks >> 1, 1, key, 0, false, BLAKE3_FLAG_PARENT, 0, 0, cvs[level ^ 1]);
+    }
+
+    memcpy(out, cvs[level], BLAKE3_OUT_LEN);
+}
+
+// the left subtree of a BLAKE3 tree holds the largest power of two of whole chunks that leaves the right one non-empty
+size_t blake3_left_len_f(size_t len)
+{
+    size_t full_chunks = (len - 1) / BLAKE3_CHUNK_LEN;
+    size_t left = 1;
+    while ((left << 1) <= full_chunks) {
+        left <<= 1;
+    }
+    return left * BLAKE3_CHUNK_LEN;
+}
+
+// chaining value of any non-root subtree
+void blake3_subtree_cv_f(const uint32_t key[8], const uint8_t* input, size_t len, uint64_t counter, uint8_t out[BLAKE3_OUT_LEN])
+{
+    size_t chunks = len / BLAKE3_CHUNK_LEN;
+    if (len <= BLAKE3_CHUNK_LEN) {
+        blake3_chunk_cv_f(key, input, len, counter, out);
+    } else if (((len % BLAKE3_CHUNK_LEN) == 0) && ((chunks & (chunks - 1)) == 0) && (chunks <= BLAKE3_GROUP_CHUNKS)) {
+        blake3_wide_cv_f(key, input, chunks, counter, out);
+    } else {
+        uint8_t cvs[BLAKE3_OUT_LEN << 1];
+        size_t left = blake3_left_len_f(len);
+        blake3_subtree_cv_f(key, input, left, counter, cvs);
+        blake3_subtree_cv_f(key, input + left, len - left, counter + left / BLAKE3_CHUNK_LEN, cvs + BLAKE3_OUT_LEN);
+        blake3_parent_cv_f(key, cvs, cvs + BLAKE3_OUT_LEN, 0, out);
+    }
+}
+
+typedef struct blake3_job {
+    uint32_t key[8];
+    const uint8_t* input;
+    size_t len;
+    uint8_t* cvs; // one per group
+} blake3_job_t;
+
+void blake3_group_f(void* job_ptr, uint32_t i)
+{
+    blake3_job_t* job = (blake3_job_t*)job_ptr;
+    size_t offset = (size_t)i * BLAKE3_GROUP_BYTES;
+    size_t len = job->len - offset < BLAKE3_GROUP_BYTES ? job->len - offset : BLAKE3_GROUP_BYTES;
+    blake3_subtree_cv_f(job->key, job->input + offset, len, (uint64_t)i * BLAKE3_GROUP_CHUNKS, job->cvs + (size_t)i * BLAKE3_OUT_LEN);
+}
+
+// every whole group is a subtree, and so is the trailing partial one; they combine like chunks do
+void blake3_merge_f(const uint32_t key[8], const uint8_t* cvs, uint32_t count, bool root, uint8_t out[BLAKE3_OUT_LEN])
+{
+    if (count == 1) {
+        memcpy(out, cvs, BLAKE3_OUT_LEN);
+        return;
+    }
+    uint32_t left = 1;
+    while ((left << 1) < count) {
+        left <<= 1;
+    }
+    uint8_t children[BLAKE3_OUT_LEN << 1];
+    blake3_merge_f(key, cvs, left, false, children);
+    blake3_merge_f(key, cvs + (size_t)left * BLAKE3_OUT_LEN, count - left, false, children + BLAKE3_OUT_LEN);
+    blake3_parent_cv_f(key, children, children + BLAKE3_OUT_LEN, root ? BLAKE3_FLAG_ROOT : 0, out);
+}
+
+// the plain BLAKE3 hash of data, spread across threads for large inputs
+void blake3_hash_parallel_f(const uint8_t* data, size_t len, uint32_t threads, uint8_t hash[BLAKE3_OUT_LEN])
+{
+    size_t groups = (len + BLAKE3_GROUP_BYTES - 1) / BLAKE3_GROUP_BYTES;
+    blake3_job_t job;
+
+    if ((threads <= 1) || (len < BLAKE3_PARALLEL_MIN_BYTES) || (groups > UINT32_MAX)
+        || ((job.cvs = (uint8_t*)malloc(groups * BLAKE3_OUT_LEN)) == nullptr)) {
+        blake3_hash(data, len, hash);
+        return;
+    }
+
+    blake3_hasher hasher;
+    blake3_hasher_init(&hasher);
+    memcpy(job.key, hasher.key, sizeof(job.key));
+    job.input = data;
+    job.len = len;
+
+    parallel_for_f(threads, (uint32_t)groups, blake3_group_f, (void*)&job);
+    blake3_merge_f(job.key, job.cvs, (uint32_t)groups, true, hash);
+
+    free((void*)job.cvs);
+}
+
 typedef struct db_entry {
     char magic[8]; // "DbEntry"
     uint8_t hash[32];
@@ -36,6 +246,8 @@ typedef struct db_entry {
 #define DB_MAGIC_NUMBER "InstaDB"
 #define DB_ENTRY_MAGIC_NUMBER "DbEntry"
 #define DB_ENTRY_ARRAY_MAGIC_NUMBER "DbEntAr"
+#define DB_ENTRY_EXTERNAL_MAGIC_NUMBER "DbEntXt"
+#define DB_DATA_MAGIC_NUMBER "InstaDD"
 
 typedef struct db {
     char magic[8]; // "InstaDB"
@@ -44,6 +256,44 @@ typedef struct db {
     uint32_t buckets[]; // index = size >> INDEX_SIZE_SHIFT
 } db_t;
 
+// In the split layout, the bodies of chunks that compress to more than
+// INLINE_DATA_MAX_SIZE_BYTES live in data files; their db_entry holds a
+// db_extent instead. Array entries always stay inline.
+#define INLINE_DATA_MAX_SIZE_BYTES 192
+#define DATA_FILES_MAX 16
+#define DATA_ALIGN_SHIFT 4
+
+#define DATA_ID_SIZE 16
+
+typedef struct db_data {
+    char magic[8]; // "InstaDD"
+    uint64_t size;
+    uint64_t used;
+    uint8_t id[DATA_ID_SIZE]; // db_data_id.id of the index it belongs to
+    uint32_t ordinal; // its position in data_files
+    uint32_t reserved;
+    uint8_t data[];
+} db_data_t;
+
+// the data files an index has been used with, stored inline under DATA_ID_KEY
+#define DB_ENTRY_DATA_ID_MAGIC_NUMBER "DbDatId"
+
+typedef struct db_data_id {
+    uint8_t id[DATA_ID_SIZE];
+    uint32_t count; // data files initialized so far
+} db_data_id_t;
+
+// not a BLAKE3 hash anything is known to have
+static const uint8_t DATA_ID_KEY[BLAKE3_OUT_LEN] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+typedef struct db_extent {
+    uint32_t file;
+    uint32_t offset; // offset = byte offset >> DATA_ALIGN_SHIFT
+} db_extent_t;
+
 #define QUERY_SIZE 32
 
 typedef struct db_wrapper {
@@ -52,8 +302,20 @@ typedef struct db_wrapper {
     db_t* RO;
     struct db_wrapper* copy;
     struct db_wrapper* rodb;
+    uint32_t data_count;
+    db_data_t* data_RW[DATA_FILES_MAX];
+    db_data_t* data_RO[DATA_FILES_MAX];
+    size_t data_mapped[DATA_FILES_MAX];
+    bool content_addressing; // key chunked values by the hash of their content
+    uint8_t verify; // VERIFY_*
+    uint32_t verify_sample; // check one in this many chunks when VERIFY_SAMPLED
+    uint32_t threads;
 } db_wrapper_t;
 
+#define VERIFY_NONE 0
+#define VERIFY_FULL 1
+#define VERIFY_SAMPLED 2
+
 extern inline db_entry_t* bucket_to_entry_f(db_t* db, uint32_t bucket)
 {
     return (db_entry_t*)(((uint8_t*)(db)) + (((ptrdiff_t)(bucket)) << ENTRY_SIZE_SHIFT));
@@ -64,6 +326,22 @@ extern inline uint32_t entry_to_bucket_f(db_t* db, db_entry_t* entry)
     return (uint32_t)(((uint8_t*)db - (uint8_t*)entry) >> ENTRY_SIZE_SHIFT);
 }
 
+// the compressed body of an entry in dbc, or nullptr if its extent is out of bounds
+const uint8_t* entry_body_f(db_wrapper_t* dbc, db_entry_t* entry)
+{
+    if (strcmp(entry->magic, DB_ENTRY_EXTERNAL_MAGIC_NUMBER)) {
+        return entry->data;
+    }
+
+    const db_extent_t* extent = (const db_extent_t*)entry->data;
+    size_t offset = ((size_t)extent->offset) << DATA_ALIGN_SHIFT;
+    if ((extent->file >= dbc->data_count) || (offset + entry->size > dbc->data_mapped[extent->file])) {
+        return nullptr;
+    }
+
+    return ((const uint8_t*)dbc->data_RO[extent->file]) + offset;
+}
+
 const char* error_texts[] = {
     "napi_ok",
     "napi_invalid_arg",
@@ -165,7 +443,202 @@ db_wrapper_t* db_alloc_f(const char* filename, ssize_t size, bool readonly)
     return wrapper;
 }
 
-void db_alloc_sub_f(napi_env env, napi_value buf, db_wrapper_t* db, ssize_t size, bool readonly)
+void db_free_f(db_wrapper_t* db);
+uint32_t db_find_chunk_by_hash_f(db_t* db, uint8_t hash[BLAKE3_OUT_LEN]);
+
+void db_data_error_f(napi_env env, const char* format, const char* filename, const char* reason)
+{
+    char message[512];
+    snprintf(message, sizeof(message), format, filename, reason);
+    napi_throw_error(env, nullptr, message);
+}
+
+// the identity db's data files must carry, or nullptr if it has never had any
+db_data_id_t* db_data_id_f(db_t* db)
+{
+    uint32_t bucket = db_find_chunk_by_hash_f(db, (uint8_t*)DATA_ID_KEY);
+    if (bucket == 0) {
+        return nullptr;
+    }
+    db_entry_t* entry = bucket_to_entry_f(db, bucket);
+    if (strcmp(entry->magic, DB_ENTRY_DATA_ID_MAGIC_NUMBER) || (entry->size != sizeof(db_data_id_t))) {
+        return nullptr;
+    }
+    return (db_data_id_t*)entry->data;
+}
+
+// opens the next data file of db, and checks that it is the one its index expects there;
+// new files are left for dbw_init_data_f. Throws and returns false on failure.
+bool db_alloc_data_f(napi_env env, db_wrapper_t* db, const char* filename, ssize_t size, bool readonly)
+{
+    if (db->data_count >= DATA_FILES_MAX) {
+        db_data_error_f(env, "Could not open '%s': %s", filename, "too many data files");
+        return false;
+    }
+
+    int fd = open(filename, readonly ? O_RDONLY : O_RDWR | O_CREAT, readonly ? 0400 : 0600);
+    if (fd <= 0) {
+        db_data_error_f(env, "Could not open '%s': %s", filename, strerror(errno));
+        return false;
+    }
+
+    struct stat s;
+    if (fstat(fd, &s)) {
+        db_data_error_f(env, "Could not open '%s': %s", filename, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    if (!readonly && (s.st_size < size)) {
+        if (ftruncate(fd, size) || fstat(fd, &s)) {
+            db_data_error_f(env, "Could not truncate '%s': %s", filename, strerror(errno));
+            close(fd);
+            return false;
+        }
+    }
+
+    if ((size_t)s.st_size <= sizeof(db_data_t)) {
+        db_data_error_f(env, "Could not open '%s': %s", filename, "not a data file");
+        close(fd);
+        return false;
+    }
+
+    db_data_t* data_RO = (db_data_t*)mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data_RO == MAP_FAILED) {
+        db_data_error_f(env, "Could not map '%s': %s", filename, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    db_data_t* data_RW = nullptr;
+    if (!readonly) {
+        data_RW = (db_data_t*)mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data_RW == MAP_FAILED) {
+            db_data_error_f(env, "Could not map '%s': %s", filename, strerror(errno));
+            munmap(data_RO, s.st_size);
+            close(fd);
+            return false;
+        }
+    }
+
+    close(fd);
+
+    uint32_t ordinal = db->data_count;
+    db->data_RO[ordinal] = data_RO;
+    db->data_RW[ordinal] = data_RW;
+    db->data_mapped[ordinal] = s.st_size;
+    db->data_count++;
+
+    const db_data_id_t* data_id = db_data_id_f(db->RO);
+    if (!readonly && (data_RO->size == 0) && !strcmp(data_RO->magic, "")) {
+        if ((data_id != nullptr) && (ordinal < data_id->count)) {
+            db_data_error_f(env, "Could not use '%s': %s", filename, "it is empty, but the database stored data in this position");
+            return false;
+        }
+        return true;
+    }
+
+    if (strcmp(data_RO->magic, DB_DATA_MAGIC_NUMBER) || (data_RO->size > (uint64_t)s.st_size) || (data_RO->used > data_RO->size)) {
+        db_data_error_f(env, "Could not open '%s': %s", filename, "not a data file");
+        return false;
+    }
+
+    if ((data_id == nullptr) || memcmp(data_RO->id, data_id->id, DATA_ID_SIZE)) {
+        db_data_error_f(env, "Could not use '%s': %s", filename, "it belongs to another database");
+        return false;
+    }
+
+    if (data_RO->ordinal != ordinal) {
+        char reason[64];
+        snprintf(reason, sizeof(reason), "it is data file #%u of the database, not #%u", data_RO->ordinal, ordinal);
+        db_data_error_f(env, "Could not use '%s': %s", filename, reason);
+        return false;
+    }
+
+    return true;
+}
+
+// buf lists data files the same way __copies lists storage files; any failure is fatal,
+// since extents refer to data files by position
+bool db_alloc_data_list_f(napi_env env, napi_value buf, db_wrapper_t* db, const char* index_name, ssize_t size, bool readonly)
+{
+    size_t data_len = 0;
+    const char* data = "0\0 0\0";
+
+    status = napi_get_buffer_info(env, buf, (void**)&data, &data_len);
+    if (status != napi_ok) {
+        data_len = 0;
+    }
+
+    size_t num_entries = 0;
+    if (data_len > 0) {
+        sscanf(data, "%ld", &num_entries);
+    }
+
+    for (size_t i = 0; (data_len > 0) && (i < num_entries); ++i) {
+        while (--data_len && *(data++))
+            ; // get next filename
+        if ((data_len > 0) && (*data)) {
+            if (!db_alloc_data_f(env, db, data, size, readonly)) {
+                return false;
+            }
+        }
+    }
+
+    const db_data_id_t* data_id = db_data_id_f(db->RO);
+    if ((data_id != nullptr) && (db->data_count < data_id->count)) {
+        char reason[64];
+        snprintf(reason, sizeof(reason), "it has %u data files, %u given", data_id->count, db->data_count);
+        db_data_error_f(env, "Could not open '%s': %s", index_name, reason);
+        return false;
+    }
+
+    return true;
+}
+
+int advice_from_string_f(const char* advice, int fallback)
+{
+    if (!strcmp(advice, "normal")) {
+        return MADV_NORMAL;
+    } else if (!strcmp(advice, "random")) {
+        return MADV_RANDOM;
+    } else if (!strcmp(advice, "sequential")) {
+        return MADV_SEQUENTIAL;
+    } else if (!strcmp(advice, "willneed")) {
+        return MADV_WILLNEED;
+    }
+    return fallback;
+}
+
+void db_advise_one_f(db_wrapper_t* dbc, int index_advice, int data_advice, bool pin_index)
+{
+    size_t index_size = ((size_t)dbc->RO->size) << ENTRY_SIZE_SHIFT;
+    if (index_advice >= 0) {
+        madvise(dbc->RO, index_size, index_advice);
+    }
+    if (pin_index && mlock(dbc->RO, index_size)) {
+        fprintf(stderr, "Could not pin index in memory: %s\n", strerror(errno));
+    }
+    for (uint32_t i = 0; (data_advice >= 0) && (i < dbc->data_count); ++i) {
+        madvise(dbc->data_RO[i], dbc->data_mapped[i], data_advice);
+    }
+}
+
+// readahead and caching policy, per tier; advice < 0 keeps the kernel default.
+// Copies are only ever written, so their index is not pinned.
+void db_advise_f(db_wrapper_t* db, int index_advice, int data_advice, bool pin_index)
+{
+    for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->copy) {
+        db_advise_one_f(dbc, index_advice, data_advice, pin_index && (dbc == db));
+    }
+    for (db_wrapper_t* dbc = db->rodb; dbc != nullptr; dbc = dbc->rodb) {
+        db_advise_one_f(dbc, index_advice, data_advice, pin_index);
+    }
+}
+
+// data_lists[i], if any, lists the data files of the i-th file in buf.
+// Storage files that cannot be opened are skipped; data file problems throw and return false.
+bool db_alloc_sub_f(napi_env env, napi_value buf, napi_value data_lists, db_wrapper_t* db, ssize_t size, ssize_t data_size, bool readonly)
 {
     size_t data_len = 0;
     const char* data = "0\0 0\0";
@@ -173,7 +646,7 @@ void db_alloc_sub_f(napi_env env, napi_value buf, db_wrapper_t* db, ssize_t size
     status = napi_get_buffer_info(env, buf, (void**)&data, &data_len);
     if (status != napi_ok) {
         fprintf(stderr, "Invalid DB options.\n");
-        return;
+        return true;
     }
 
     size_t num_entries = 0;
@@ -185,6 +658,27 @@ void db_alloc_sub_f(napi_env env, napi_value buf, db_wrapper_t* db, ssize_t size
         if ((data_len > 0) && (*data)) {
             db_wrapper_t* ndb = db_alloc_f(data, size, readonly);
             if (ndb != NULL) {
+                napi_value data_list = nullptr;
+                if (napi_get_element(env, data_lists, i, &data_list) != napi_ok) {
+                    data_list = nullptr;
+                }
+                if (!db_alloc_data_list_f(env, data_list, ndb, data, data_size, readonly)) {
+                    db_free_f(ndb);
+                    return false;
+                }
+                if (!readonly) {
+                    // copies receive every body at the offset it has in the main data files
+                    bool fits = ndb->data_count == db->data_count;
+                    for (uint32_t j = 0; fits && (j < db->data_count); ++j) {
+                        uint64_t capacity = db->data_RO[j]->size ? db->data_RO[j]->size : db->data_mapped[j];
+                        fits = ndb->data_mapped[j] >= capacity;
+                    }
+                    if (!fits) {
+                        db_data_error_f(env, "Could not use copy '%s': %s", data, "its data files do not match those of the database");
+                        db_free_f(ndb);
+                        return false;
+                    }
+                }
                 if (readonly) {
                     ndb->rodb = db->rodb;
                     db->rodb = ndb;
@@ -195,9 +689,10 @@ void db_alloc_sub_f(napi_env env, napi_value buf, db_wrapper_t* db, ssize_t size
             }
         }
     }
+
+    return true;
 }
 
-void db_free_f(db_wrapper_t* db);
 void db_free_f(db_wrapper_t* db)
 {
     if (db == nullptr) {
@@ -220,6 +715,13 @@ void db_free_f(db_wrapper_t* db)
         munmap(db->RW, db->RW->size << ENTRY_SIZE_SHIFT);
     }
 
+    for (uint32_t i = 0; i < db->data_count; ++i) {
+        munmap(db->data_RO[i], db->data_mapped[i]);
+        if (db->data_RW[i] != nullptr) {
+            munmap(db->data_RW[i], db->data_mapped[i]);
+        }
+    }
+
     free((void*)db);
 }
 
@@ -252,101 +754,645 @@ size_t decompress_f(const void* in, size_t in_nbytes, void* out, size_t out_nbyt
     return actual_out_nbytes_ret;
 }
 
-uint32_t db_find_chunk_by_hash_f(db_t* db, uint8_t hash[BLAKE3_OUT_LEN])
+// Stored chunks are zlib streams. To serve a multi-chunk value compressed
+// without recompressing it, the raw deflate streams of its chunks are
+// concatenated: every chunk but the last has the BFINAL bit of its final
+// block cleared, and an empty stored block realigns the output to a byte
+// boundary before the next chunk, so each chunk is a plain memcpy. Finding
+// the final block and the stream's exact end takes walking the Huffman
+// codes (after puff.c by Mark Adler); nothing is decompressed.
+
+#define DEFLATE_MAX_BITS 15
+#define DEFLATE_MAX_LCODES 286
+#define DEFLATE_MAX_DCODES 30
+#define DEFLATE_FIX_LCODES 288
+#define DEFLATE_FAST_BITS 10
+#define ZLIB_HEADER_SIZE 2
+#define ZLIB_TRAILER_SIZE 4
+#define GZIP_HEADER_SIZE 10
+#define GZIP_TRAILER_SIZE 8
+#define ADLER32_BASE 65521
+
+typedef struct deflate_huffman {
+    uint16_t count[DEFLATE_MAX_BITS + 1];
+    uint16_t symbol[DEFLATE_FIX_LCODES];
+    uint16_t fast[1 << DEFLATE_FAST_BITS]; // symbol << 4 | length, for codes up to DEFLATE_FAST_BITS long
+} deflate_huffman_t;
+
+typedef struct deflate_scan {
+    const uint8_t* in;
+    size_t len;
+    size_t bit;
+} deflate_scan_t;
+
+// at least 56 valid bits, zero past the end of input
+inline uint64_t deflate_peek_f(deflate_scan_t* s)
 {
-    uint32_t bucket_index = *((uint32_t*)(hash)) % (db->size >> INDEX_SIZE_SHIFT);
-    uint32_t bucket = db->buckets[bucket_index];
-
-    while (bucket) {
-        if (bucket >= db->used) {
-            napi_throw_error(genv, nullptr, "Hash table corrupted.");
-            return 0;
-        }
-
-        db_entry_t* entry = bucket_to_entry_f(db, bucket);
-
-        if (!memcmp(entry->hash, hash, BLAKE3_OUT_LEN)) {
-            return bucket;
-        } else {
-            bucket = entry->next;
+    size_t byte = s->bit >> 3;
+    uint64_t window = 0;
+    if (byte + sizeof(window) <= s->len) {
+        memcpy(&window, s->in + byte, sizeof(window));
+    } else {
+        for (size_t i = 0; byte + i < s->len; ++i) {
+            window |= ((uint64_t)s->in[byte + i]) << (i << 3);
         }
     }
-
-    return 0;
+    return window >> (s->bit & 7);
 }
 
-uint32_t dbw_insert_chunk_f(db_wrapper_t* db, uint8_t* data, uint16_t length)
+inline uint32_t deflate_bits_f(deflate_scan_t* s, int n)
 {
-    uint8_t hash[BLAKE3_OUT_LEN] = "";
-
-    blake3_hash(data, length, (uint8_t*)&hash);
-
-    uint32_t found = db_find_chunk_by_hash_f(db->RO, hash);
+    uint32_t value = (uint32_t)(deflate_peek_f(s) & ((((uint64_t)1) << n) - 1));
+    s->bit += n;
+    return value;
+}
 
-    if (found != 0) {
-        return found;
+int deflate_decode_f(deflate_scan_t* s, const deflate_huffman_t* h)
+{
+    uint64_t window = deflate_peek_f(s);
+    uint16_t fast = h->fast[window & ((1 << DEFLATE_FAST_BITS) - 1)];
+    if (fast) {
+        s->bit += fast & 15;
+        return fast >> 4;
     }
 
-    uint32_t bucket_index = *((uint32_t*)(hash)) % (db->RO->size >> INDEX_SIZE_SHIFT);
-
-    if (db->RO->used >= db->RO->size) {
-        napi_throw_error(genv, nullptr, "Database is full!");
-        return 0;
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= DEFLATE_MAX_BITS; ++len) {
+        code |= (int)(window & 1);
+        window >>= 1;
+        int count = h->count[len];
+        if (code - count < first) {
+            s->bit += len;
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
     }
+    return -1;
+}
 
-    uint32_t bucket = db->RW->used;
-    db_entry_t* entry = bucket_to_entry_f(db->RW, bucket);
+// returns 0 for a complete code, > 0 for an incomplete one, < 0 if over-subscribed
+int deflate_construct_f(deflate_huffman_t* h, const uint16_t* length, int n)
+{
+    uint16_t offs[DEFLATE_MAX_BITS + 1];
 
-    size_t available_space = (((size_t)db->RO->size - (size_t)db->RO->used) << ENTRY_SIZE_SHIFT) - sizeof(db_entry_t);
-    if (available_space < ENTRY_MAX_SIZE_BYTES) {
-        napi_throw_error(genv, nullptr, "Database is too full! (available_space < ENTRY_MAX_SIZE_BYTES)");
-        return 0;
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast, 0, sizeof(h->fast));
+    for (int symbol = 0; symbol < n; ++symbol) {
+        h->count[length[symbol]]++;
     }
-
-    entry->size = compress_f(data, length, entry->data, available_space);
-    if (entry->size == 0) {
-        napi_throw_error(genv, nullptr, "Database is too full! (compression failed)");
+    if (h->count[0] == n) {
         return 0;
     }
 
-    entry->len = length;
-    entry->val = 0; // NULL
-    memcpy(entry->hash, hash, BLAKE3_OUT_LEN);
-    memcpy(entry->magic, DB_ENTRY_MAGIC_NUMBER, sizeof(DB_ENTRY_MAGIC_NUMBER));
+    int left = 1;
+    for (int len = 1; len <= DEFLATE_MAX_BITS; ++len) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) {
+            return left;
+        }
+    }
 
-    size_t new_data_size_bytes = entry->size + sizeof(db_entry_t);
-    size_t new_data_size = ((new_data_size_bytes - 1) >> ENTRY_SIZE_SHIFT) + 1;
-    for (db_wrapper_t* dbc = db->copy; dbc != nullptr; dbc = dbc->copy) {
-        db_entry_t* dest = bucket_to_entry_f(dbc->RW, bucket);
-        memcpy(dest, entry, new_data_size_bytes);
+    offs[1] = 0;
+    for (int len = 1; len < DEFLATE_MAX_BITS; ++len) {
+        offs[len + 1] = offs[len] + h->count[len];
     }
-    for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->copy) {
-        db_entry_t* entry_c = bucket_to_entry_f(dbc->RW, bucket);
-        entry_c->next = dbc->RW->buckets[bucket_index];
-        dbc->RW->buckets[bucket_index] = bucket;
-        dbc->RW->used += new_data_size;
+    for (int symbol = 0; symbol < n; ++symbol) {
+        if (length[symbol] != 0) {
+            h->symbol[offs[length[symbol]]++] = symbol;
+        }
     }
 
-    return bucket;
-}
+    // codes are stored bit-reversed, so every window starting with one indexes its entry
+    int code = 0, index = 0;
+    for (int len = 1; len <= DEFLATE_FAST_BITS; ++len) {
+        for (int i = 0; i < h->count[len]; ++i, ++code, ++index) {
+            int reversed = 0;
+            for (int b = 0; b < len; ++b) {
+                reversed |= ((code >> b) & 1) << (len - 1 - b);
+            }
+            for (int fill = reversed; fill < (1 << DEFLATE_FAST_BITS); fill += 1 << len) {
+                h->fast[fill] = (uint16_t)((h->symbol[index] << 4) | len);
+            }
+        }
+        code <<= 1;
+    }
 
-typedef struct db_entry_array {
-    uint32_t data_length;
-    uint32_t array_length;
-    uint32_t buckets[];
-} db_entry_array_t;
+    return left;
+}
 
-uint32_t dbw_insert_buffer_f(db_wrapper_t* db, uint8_t* data, uint32_t length)
+bool deflate_skip_codes_f(deflate_scan_t* s, const deflate_huffman_t* lencode, const deflate_huffman_t* distcode)
+{
+    static const uint8_t lext[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const uint8_t dext[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    size_t limit = s->len << 3;
+    int symbol;
+    do {
+        symbol = deflate_decode_f(s, lencode);
+        if (symbol < 0) {
+            return false;
+        }
+        if (symbol > 256) {
+            symbol -= 257;
+            if (symbol >= 29) {
+                return false;
+            }
+            s->bit += lext[symbol];
+            int dist = deflate_decode_f(s, distcode);
+            if ((dist < 0) || (dist >= 30)) {
+                return false;
+            }
+            s->bit += dext[dist];
+        }
+        if (s->bit > limit) {
+            return false;
+        }
+    } while (symbol != 256);
+
+    return true;
+}
+
+bool deflate_skip_fixed_f(deflate_scan_t* s)
+{
+    static deflate_huffman_t lencode, distcode;
+    static bool built = false;
+
+    if (!built) {
+        uint16_t lengths[DEFLATE_FIX_LCODES];
+        int symbol = 0;
+        for (; symbol < 144; ++symbol) {
+            lengths[symbol] = 8;
+        }
+        for (; symbol < 256; ++symbol) {
+            lengths[symbol] = 9;
+        }
+        for (; symbol < 280; ++symbol) {
+            lengths[symbol] = 7;
+        }
+        for (; symbol < DEFLATE_FIX_LCODES; ++symbol) {
+            lengths[symbol] = 8;
+        }
+        deflate_construct_f(&lencode, lengths, DEFLATE_FIX_LCODES);
+        for (symbol = 0; symbol < DEFLATE_MAX_DCODES; ++symbol) {
+            lengths[symbol] = 5;
+        }
+        deflate_construct_f(&distcode, lengths, DEFLATE_MAX_DCODES);
+        built = true;
+    }
+
+    return deflate_skip_codes_f(s, &lencode, &distcode);
+}
+
+bool deflate_skip_dynamic_f(deflate_scan_t* s)
+{
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    uint16_t lengths[DEFLATE_MAX_LCODES + DEFLATE_MAX_DCODES];
+    deflate_huffman_t lencode, distcode;
+
+    int nlen = deflate_bits_f(s, 5) + 257;
+    int ndist = deflate_bits_f(s, 5) + 1;
+    int ncode = deflate_bits_f(s, 4) + 4;
+    if ((nlen > DEFLATE_MAX_LCODES) || (ndist > DEFLATE_MAX_DCODES)) {
+        return false;
+    }
+
+    int index = 0;
+    for (; index < ncode; ++index) {
+        lengths[order[index]] = deflate_bits_f(s, 3);
+    }
+    for (; index < 19; ++index) {
+        lengths[order[index]] = 0;
+    }
+    if (deflate_construct_f(&lencode, lengths, 19) != 0) {
+        return false;
+    }
+
+    index = 0;
+    while (index < nlen + ndist) {
+        int symbol = deflate_decode_f(s, &lencode);
+        if (symbol < 0) {
+            return false;
+        }
+        if (symbol < 16) {
+            lengths[index++] = symbol;
+        } else {
+            uint16_t len = 0;
+            if (symbol == 16) {
+                if (index == 0) {
+                    return false;
+                }
+                len = lengths[index - 1];
+                symbol = 3 + deflate_bits_f(s, 2);
+            } else if (symbol == 17) {
+                symbol = 3 + deflate_bits_f(s, 3);
+            } else {
+                symbol = 11 + deflate_bits_f(s, 7);
+            }
+            if (index + symbol > nlen + ndist) {
+                return false;
+            }
+            while (symbol--) {
+                lengths[index++] = len;
+            }
+        }
+    }
+
+    if (lengths[256] == 0) {
+        return false;
+    }
+
+    int err = deflate_construct_f(&lencode, lengths, nlen);
+    if ((err < 0) || ((err > 0) && (nlen != lencode.count[0] + lencode.count[1]))) {
+        return false;
+    }
+    err = deflate_construct_f(&distcode, lengths + nlen, ndist);
+    if ((err < 0) || ((err > 0) && (ndist != distcode.count[0] + distcode.count[1]))) {
+        return false;
+    }
+
+    return deflate_skip_codes_f(s, &lencode, &distcode);
+}
+
+// finds the bit offsets of the last block's BFINAL bit and of the end of a raw deflate stream
+bool deflate_scan_f(const uint8_t* in, size_t len, size_t* final_bit, size_t* end_bit)
+{
+    deflate_scan_t s = { in, len, 0 };
+
+    for (;;) {
+        size_t block_bit = s.bit;
+        uint32_t last = deflate_bits_f(&s, 1);
+        uint32_t type = deflate_bits_f(&s, 2);
+        bool ok = false;
+
+        if (type == 0) {
+            size_t byte = (s.bit + 7) >> 3;
+            if (byte + 4 <= len) {
+                uint32_t stored = in[byte] | (in[byte + 1] << 8);
+                uint32_t nstored = in[byte + 2] | (in[byte + 3] << 8);
+                s.bit = (byte + 4 + stored) << 3;
+                ok = (stored == (~nstored & 0xffff));
+            }
+        } else if (type == 1) {
+            ok = deflate_skip_fixed_f(&s);
+        } else if (type == 2) {
+            ok = deflate_skip_dynamic_f(&s);
+        }
+
+        if (!ok || (s.bit > (len << 3))) {
+            return false;
+        }
+
+        if (last) {
+            *final_bit = block_bit;
+            *end_bit = s.bit;
+            return true;
+        }
+    }
+}
+
+// bits needed to bring a stream at bit offset `bit` to a byte boundary with an empty stored block
+inline size_t deflate_align_bits_f(size_t bit)
+{
+    return (bit & 7) ? ((((bit + 3 + 7) >> 3) + 4) << 3) - bit : 0;
+}
+
+uint32_t adler32_combine_f(uint32_t adler1, uint32_t adler2, uint32_t len2)
+{
+    uint32_t rem = len2 % ADLER32_BASE;
+    uint32_t sum1 = adler1 & 0xffff;
+    uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % ADLER32_BASE);
+    sum1 += (adler2 & 0xffff) + ADLER32_BASE - 1;
+    sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + ADLER32_BASE - rem;
+    if (sum1 >= ADLER32_BASE) {
+        sum1 -= ADLER32_BASE;
+    }
+    if (sum1 >= ADLER32_BASE) {
+        sum1 -= ADLER32_BASE;
+    }
+    if (sum2 >= (ADLER32_BASE << 1)) {
+        sum2 -= (ADLER32_BASE << 1);
+    }
+    if (sum2 >= ADLER32_BASE) {
+        sum2 -= ADLER32_BASE;
+    }
+    return sum1 | (sum2 << 16);
+}
+
+uint32_t db_find_chunk_by_hash_f(db_t* db, uint8_t hash[BLAKE3_OUT_LEN])
+{
+    uint32_t bucket_index = *((uint32_t*)(hash)) % (db->size >> INDEX_SIZE_SHIFT);
+    uint32_t bucket = db->buckets[bucket_index];
+
+    while (bucket) {
+        if (bucket >= db->used) {
+            napi_throw_error(genv, nullptr, "Hash table corrupted.");
+            return 0;
+        }
+
+        db_entry_t* entry = bucket_to_entry_f(db, bucket);
+
+        if (!memcmp(entry->hash, hash, BLAKE3_OUT_LEN)) {
+            return bucket;
+        } else {
+            bucket = entry->next;
+        }
+    }
+
+    return 0;
+}
+
+db_entry_t* dbw_reserve_entry_f(db_wrapper_t* db, size_t* available_space)
+{
+    if (db->RO->used >= db->RO->size) {
+        napi_throw_error(genv, nullptr, "Database is full!");
+        return nullptr;
+    }
+
+    *available_space = (((size_t)db->RO->size - (size_t)db->RO->used) << ENTRY_SIZE_SHIFT) - sizeof(db_entry_t);
+    if (*available_space < ENTRY_MAX_SIZE_BYTES) {
+        napi_throw_error(genv, nullptr, "Database is too full! (available_space < ENTRY_MAX_SIZE_BYTES)");
+        return nullptr;
+    }
+
+    return bucket_to_entry_f(db->RW, db->RW->used);
+}
+
+// appends body to the first data file with room for it, at the same offset in every copy
+bool dbw_append_data_f(db_wrapper_t* db, const uint8_t* body, uint16_t size, db_extent_t* extent)
+{
+    uint64_t aligned = ((((uint64_t)size - 1) >> DATA_ALIGN_SHIFT) + 1) << DATA_ALIGN_SHIFT;
+
+    for (uint32_t i = 0; i < db->data_count; ++i) {
+        uint64_t offset = db->data_RO[i]->used;
+        uint64_t used = offset + aligned;
+        if ((used > db->data_RO[i]->size) || ((used >> DATA_ALIGN_SHIFT) > UINT32_MAX)) {
+            continue;
+        }
+
+        // copies were checked to be at least as large when they were opened
+        for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->copy) {
+            memcpy(((uint8_t*)dbc->data_RW[i]) + offset, body, size);
+        }
+        for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->copy) {
+            dbc->data_RW[i]->used = used;
+        }
+
+        extent->file = i;
+        extent->offset = (uint32_t)(offset >> DATA_ALIGN_SHIFT);
+        return true;
+    }
+
+    napi_throw_error(genv, nullptr, "Database is full! (no room left in data files)");
+    return false;
+}
+
+// entry must be the one returned by dbw_reserve_entry_f, with size and len filled in;
+// body holds the compressed data, and may be entry->data already
+uint32_t dbw_append_entry_f(db_wrapper_t* db, db_entry_t* entry, const uint8_t hash[BLAKE3_OUT_LEN], const uint8_t* body, const char* magic)
+{
+    uint32_t bucket_index = *((uint32_t*)(hash)) % (db->RO->size >> INDEX_SIZE_SHIFT);
+    uint32_t bucket = db->RW->used;
+    size_t inline_size = entry->size;
+
+    if (db->data_count && !strcmp(magic, DB_ENTRY_MAGIC_NUMBER) && (entry->size > INLINE_DATA_MAX_SIZE_BYTES)) {
+        // the body goes first, so that the index never points at data that is not there
+        db_extent_t extent;
+        if (!dbw_append_data_f(db, body, entry->size, &extent)) {
+            return 0;
+        }
+        memcpy(entry->data, &extent, sizeof(extent));
+        inline_size = sizeof(extent);
+        magic = DB_ENTRY_EXTERNAL_MAGIC_NUMBER;
+    } else if (body != entry->data) {
+        memcpy(entry->data, body, entry->size);
+    }
+
+    entry->val = 0; // NULL
+    memcpy(entry->hash, hash, BLAKE3_OUT_LEN);
+    memcpy(entry->magic, magic, sizeof(entry->magic));
+
+    size_t new_data_size_bytes = inline_size + sizeof(db_entry_t);
+    size_t new_data_size = ((new_data_size_bytes - 1) >> ENTRY_SIZE_SHIFT) + 1;
+    for (db_wrapper_t* dbc = db->copy; dbc != nullptr; dbc = dbc->copy) {
+        db_entry_t* dest = bucket_to_entry_f(dbc->RW, bucket);
+        memcpy(dest, entry, new_data_size_bytes);
+    }
+    for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->copy) {
+        db_entry_t* entry_c = bucket_to_entry_f(dbc->RW, bucket);
+        entry_c->next = dbc->RW->buckets[bucket_index];
+        dbc->RW->buckets[bucket_index] = bucket;
+        dbc->RW->used += new_data_size;
+    }
+
+    return bucket;
+}
+
+// libdeflate's zlib bound for ENTRY_MAX_SIZE_BYTES of input is ENTRY_MAX_SIZE_BYTES + 20
+#define PREPARED_CHUNK_MAX_SIZE_BYTES (ENTRY_MAX_SIZE_BYTES + 64)
+
+// inserts data under the given key rather than under its own hash
+uint32_t dbw_insert_chunk_as_f(db_wrapper_t* db, uint8_t* data, uint16_t length, const uint8_t hash[BLAKE3_OUT_LEN], const char* magic)
+{
+    uint32_t found = db_find_chunk_by_hash_f(db->RO, (uint8_t*)hash);
+
+    if (found != 0) {
+        return found;
+    }
+
+    size_t available_space = 0;
+    db_entry_t* entry = dbw_reserve_entry_f(db, &available_space);
+    if (entry == nullptr) {
+        return 0;
+    }
+
+    // chunk bodies bound for a data file should not pass through the index's page cache
+    uint8_t scratch[PREPARED_CHUNK_MAX_SIZE_BYTES];
+    bool split = db->data_count && !strcmp(magic, DB_ENTRY_MAGIC_NUMBER) && (length <= ENTRY_MAX_SIZE_BYTES);
+    uint8_t* body = split ? scratch : entry->data;
+
+    entry->size = compress_f(data, length, body, split ? sizeof(scratch) : available_space);
+    if (entry->size == 0) {
+        napi_throw_error(genv, nullptr, "Database is too full! (compression failed)");
+        return 0;
+    }
+
+    entry->len = length;
+
+    return dbw_append_entry_f(db, entry, hash, body, magic);
+}
+
+uint32_t dbw_insert_chunk_f(db_wrapper_t* db, uint8_t* data, uint16_t length)
+{
+    uint8_t hash[BLAKE3_OUT_LEN] = "";
+
+    blake3_hash(data, length, (uint8_t*)&hash);
+
+    return dbw_insert_chunk_as_f(db, data, length, hash, DB_ENTRY_MAGIC_NUMBER);
+}
+
+// records the data files of db in its index, then initializes those opened new,
+// in db and in every copy
+bool dbw_init_data_f(db_wrapper_t* db)
+{
+    if (db->data_count == 0) {
+        return true;
+    }
+
+    uint32_t bucket = db_find_chunk_by_hash_f(db->RO, (uint8_t*)DATA_ID_KEY);
+    if (bucket == 0) {
+        db_data_id_t data_id = {};
+        if (getrandom(data_id.id, DATA_ID_SIZE, 0) != DATA_ID_SIZE) {
+            napi_throw_error(genv, nullptr, "Could not generate a database id");
+            return false;
+        }
+
+        size_t available_space = 0;
+        db_entry_t* entry = dbw_reserve_entry_f(db, &available_space);
+        if (entry == nullptr) {
+            return false;
+        }
+        entry->size = sizeof(data_id);
+        entry->len = 0;
+        bucket = dbw_append_entry_f(db, entry, DATA_ID_KEY, (uint8_t*)&data_id, DB_ENTRY_DATA_ID_MAGIC_NUMBER);
+        if (bucket == 0) {
+            return false;
+        }
+    }
+
+    const db_data_id_t* data_id = (const db_data_id_t*)bucket_to_entry_f(db->RO, bucket)->data;
+    for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->copy) {
+        for (uint32_t i = data_id->count; i < dbc->data_count; ++i) {
+            db_data_t* data = dbc->data_RW[i];
+            data->size = dbc->data_mapped[i];
+            data->used = ((sizeof(db_data_t) - 1) | ((1 << DATA_ALIGN_SHIFT) - 1)) + 1;
+            memcpy(data->id, data_id->id, DATA_ID_SIZE);
+            data->ordinal = i;
+            strcpy(data->magic, DB_DATA_MAGIC_NUMBER);
+        }
+    }
+
+    // the headers go first, so that the index never lists a data file that is not there
+    uint32_t count = db->data_count;
+    for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->copy) {
+        ((db_data_id_t*)bucket_to_entry_f(dbc->RW, bucket)->data)->count = count;
+    }
+
+    return true;
+}
+
+// a chunk hashed and compressed off the main thread, waiting to be appended
+typedef struct db_prepared_chunk {
+    uint8_t hash[BLAKE3_OUT_LEN];
+    uint16_t size;
+    uint16_t len;
+    uint8_t data[PREPARED_CHUNK_MAX_SIZE_BYTES];
+} db_prepared_chunk_t;
+
+// thread-safe, as long as every thread brings its own compressor
+bool db_prepare_chunk_f(struct libdeflate_compressor* c, const uint8_t* data, uint16_t length, db_prepared_chunk_t* chunk)
+{
+    blake3_hash(data, length, chunk->hash);
+    chunk->len = length;
+    chunk->size = libdeflate_zlib_compress(c, data, length, chunk->data, sizeof(chunk->data));
+    return chunk->size != 0;
+}
+
+uint32_t dbw_insert_prepared_chunk_f(db_wrapper_t* db, db_prepared_chunk_t* chunk)
+{
+    uint32_t found = db_find_chunk_by_hash_f(db->RO, chunk->hash);
+
+    if (found != 0) {
+        return found;
+    }
+
+    size_t available_space = 0;
+    db_entry_t* entry = dbw_reserve_entry_f(db, &available_space);
+    if (entry == nullptr) {
+        return 0;
+    }
+
+    entry->size = chunk->size;
+    entry->len = chunk->len;
+
+    return dbw_append_entry_f(db, entry, chunk->hash, chunk->data, DB_ENTRY_MAGIC_NUMBER);
+}
+
+typedef struct db_entry_array {
+    uint32_t data_length;
+    uint32_t array_length;
+    uint32_t buckets[];
+} db_entry_array_t;
+
+// an array is stored as one entry, and db_entry.len is 16 bits; leave room for the zlib overhead
+#define ARRAY_MAX_LENGTH ((UINT16_MAX - 64 - sizeof(db_entry_array_t)) / sizeof(uint32_t))
+#define VALUE_MAX_SIZE_BYTES (ARRAY_MAX_LENGTH << ENTRY_MAX_SIZE_SHIFT)
+
+// takes ownership of array; content_hash is the key in content addressing mode, else nullptr
+uint32_t dbw_insert_array_f(db_wrapper_t* db, db_entry_array_t* array, const uint8_t* content_hash)
+{
+    uint32_t arr_size_bytes = sizeof(db_entry_array_t) + sizeof(uint32_t) * array->array_length;
+    uint8_t hash[BLAKE3_OUT_LEN];
+    if (content_hash == nullptr) {
+        blake3_hash(array, arr_size_bytes, hash);
+        content_hash = hash;
+    }
+    uint32_t arr_bucket = dbw_insert_chunk_as_f(db, (uint8_t*)array, arr_size_bytes, content_hash, DB_ENTRY_ARRAY_MAGIC_NUMBER);
+    free((void*)array);
+    if (arr_bucket == 0) {
+        // something went wrong, and we probably already threw
+        return 0;
+    }
+    for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->copy) {
+        db_entry_t* entry = bucket_to_entry_f(dbc->RW, arr_bucket);
+        if (!strcmp(entry->magic, DB_ENTRY_MAGIC_NUMBER)) {
+            strcpy(entry->magic, DB_ENTRY_ARRAY_MAGIC_NUMBER);
+        }
+    }
+    return arr_bucket;
+}
+
+db_entry_array_t* db_alloc_array_f(uint32_t length)
+{
+    uint32_t arr_len = ((length - 1) >> ENTRY_MAX_SIZE_SHIFT) + 1;
+    if (arr_len > ARRAY_MAX_LENGTH) {
+        napi_throw_error(genv, nullptr, "Value too large");
+        return nullptr;
+    }
+    uint32_t arr_size_bytes = sizeof(db_entry_array_t) + sizeof(uint32_t) * arr_len;
+    db_entry_array_t* array = (db_entry_array_t*)calloc(1, arr_size_bytes);
+    if (array == nullptr) {
+        napi_throw_error(genv, nullptr, "Out of memory");
+        return nullptr;
+    }
+    array->data_length = length;
+    array->array_length = arr_len;
+    return array;
+}
+
+uint32_t dbw_insert_buffer_f(db_wrapper_t* db, uint8_t* data, uint32_t length)
 {
     if (length <= ENTRY_MAX_SIZE_BYTES) {
         return dbw_insert_chunk_f(db, data, length);
     } else {
-        uint32_t arr_len = ((length - 1) >> ENTRY_MAX_SIZE_SHIFT) + 1;
-        uint32_t arr_size_bytes = sizeof(db_entry_array_t) + sizeof(uint32_t) * arr_len;
-        db_entry_array_t* array = (db_entry_array_t*)calloc(1, arr_size_bytes);
-        array->data_length = length;
-        array->array_length = arr_len;
-        for (uint32_t i = 0; i < arr_len; ++i) {
+        uint8_t content_hash[BLAKE3_OUT_LEN];
+        if (db->content_addressing) {
+            blake3_hash_parallel_f(data, length, db->threads, content_hash);
+            uint32_t found = db_find_chunk_by_hash_f(db->RO, content_hash);
+            if (found != 0) {
+                return found;
+            }
+        }
+
+        db_entry_array_t* array = db_alloc_array_f(length);
+        if (array == nullptr) {
+            return 0;
+        }
+        for (uint32_t i = 0; i < array->array_length; ++i) {
             uint32_t chunk_len = length - (i << ENTRY_MAX_SIZE_SHIFT);
             if (chunk_len > ENTRY_MAX_SIZE_BYTES) {
                 chunk_len = ENTRY_MAX_SIZE_BYTES;
@@ -357,21 +1403,707 @@ uint32_t dbw_insert_buffer_f(db_wrapper_t* db, uint8_t* data, uint32_t length)
                 return 0;
             }
         }
-        uint32_t arr_bucket = dbw_insert_chunk_f(db, (uint8_t*)array, arr_size_bytes);
-        free((void*)array);
-        if (arr_bucket == 0) {
-            // something went wrong, and we probably already threw
+        return dbw_insert_array_f(db, array, db->content_addressing ? content_hash : nullptr);
+    }
+}
+
+// chunks[] holds the prepared chunks of a buffer of the given length, in order;
+// content_hash is the key in content addressing mode, else nullptr
+uint32_t dbw_insert_prepared_buffer_f(db_wrapper_t* db, db_prepared_chunk_t* chunks, uint32_t length, const uint8_t* content_hash)
+{
+    if (length <= ENTRY_MAX_SIZE_BYTES) {
+        return dbw_insert_prepared_chunk_f(db, chunks);
+    } else {
+        if (content_hash != nullptr) {
+            uint32_t found = db_find_chunk_by_hash_f(db->RO, (uint8_t*)content_hash);
+            if (found != 0) {
+                return found;
+            }
+        }
+
+        db_entry_array_t* array = db_alloc_array_f(length);
+        if (array == nullptr) {
             return 0;
         }
-        for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->copy) {
-            db_entry_t* entry = bucket_to_entry_f(dbc->RW, arr_bucket);
-            strcpy(entry->magic, DB_ENTRY_ARRAY_MAGIC_NUMBER);
+        for (uint32_t i = 0; i < array->array_length; ++i) {
+            if ((array->buckets[i] = dbw_insert_prepared_chunk_f(db, chunks + i)) == 0) {
+                // something went wrong, and we probably already threw
+                free((void*)array);
+                return 0;
+            }
+        }
+        return dbw_insert_array_f(db, array, content_hash);
+    }
+}
+
+napi_status hash_to_string_f(napi_env env, const uint8_t hash[BLAKE3_OUT_LEN], napi_value* result)
+{
+    char strhash[BLAKE3_OUT_LEN << 1];
+    for (int i = 0; i < BLAKE3_OUT_LEN; ++i) {
+        strhash[(i << 1) + 0] = "0123456789abcdef"[hash[i] >> 4];
+        strhash[(i << 1) + 1] = "0123456789abcdef"[hash[i] & 15];
+    }
+    return napi_create_string_latin1(env, strhash, BLAKE3_OUT_LEN << 1, result);
+}
+
+// decodes hashstr in place; the first BLAKE3_OUT_LEN bytes then hold the raw hash
+void hash_from_string_f(uint8_t* hashstr)
+{
+    for (int i = 0; i < BLAKE3_OUT_LEN; ++i) {
+        uint8_t c = hashstr[(i << 1) + 0];
+        if (c >= 'a') {
+            c -= 'a' - 10;
+        } else if (c >= 'A') {
+            c -= 'A' - 10;
+        } else if (c >= '0') {
+            c -= '0';
+        }
+        uint8_t d = hashstr[(i << 1) + 1];
+        if (d >= 'a') {
+            d -= 'a' - 10;
+        } else if (d >= 'A') {
+            d -= 'A' - 10;
+        } else if (d >= '0') {
+            d -= '0';
+        }
+        hashstr[i] = (c << 4) | d;
+    }
+}
+
+napi_value dbm_store_f(napi_env env, napi_callback_info info)
+{
+    napi_value ret;
+    napi_get_undefined(env, &ret);
+    errcheckd();
+
+    genv = env;
+
+    napi_value thisarg;
+    napi_value argv[1];
+    size_t argc = 1;
+
+    status = napi_get_cb_info(env, info, &argc, argv, &thisarg, nullptr);
+    errcheck("Could not read function arguments");
+
+    napi_value query;
+    napi_get_named_property(env, thisarg, "query", &query);
+    errcheck("store() called with invalid thisArg");
+
+    bool query_is_buffer;
+    status = napi_is_buffer(env, query, &query_is_buffer);
+    errcheckd();
+    if (query_is_buffer == false) {
+        napi_throw_error(env, nullptr, "db.query is invalid.");
+        return ret;
+    }
+
+    db_wrapper_t* db = nullptr;
+    size_t query_length = 0;
+    napi_get_buffer_info(env, query, (void**)&db, &query_length);
+    errcheck("Could not get db_wrapper from query");
+    if (db == nullptr) {
+        napi_throw_error(env, nullptr, "db.query has null pointer");
+        return ret;
+    }
+
+    uint8_t* buffer_data = nullptr;
+    size_t buffer_length = 0;
+
+    napi_get_buffer_info(env, argv[0], (void**)&buffer_data, &buffer_length);
+    errcheck("db.store(): Could not get data from buffer.");
+
+    if (buffer_data == nullptr) {
+        napi_throw_error(env, nullptr, "db.store(): buffer_data is null");
+        return ret;
+    }
+
+    if (buffer_length > VALUE_MAX_SIZE_BYTES) {
+        napi_throw_error(env, nullptr, "db.store(): Value too large");
+        return ret;
+    }
+
+    uint32_t bucket = 0;
+
+    if (buffer_length != 0) {
+        bucket = dbw_insert_buffer_f(db, buffer_data, buffer_length);
+    }
+
+    if (bucket != 0) {
+        db_entry_t* entry = bucket_to_entry_f(db->RO, bucket);
+        status = hash_to_string_f(env, entry->hash, &ret);
+        errcheckd();
+    }
+
+    return ret;
+}
+
+#define COMPRESSED_FORMAT_ZLIB 0
+#define COMPRESSED_FORMAT_GZIP 1
+#define COMPRESSED_FORMAT_CHUNKS 2
+
+// serves the chunks as one zlib or gzip stream; throws and returns false on corrupted data
+bool db_stitch_f(napi_env env, db_wrapper_t* dbc, db_entry_t** entries, uint32_t count, uint32_t data_length, bool gzip, napi_value* result)
+{
+    size_t* bits = (size_t*)malloc(sizeof(size_t) * 2 * count);
+    if (bits == nullptr) {
+        napi_throw_error(env, nullptr, "Out of memory");
+        return false;
+    }
+
+    size_t total_bits = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        db_entry_t* e = entries[i];
+        const uint8_t* data = entry_body_f(dbc, e);
+        if ((data == nullptr) || (e->size <= ZLIB_HEADER_SIZE + ZLIB_TRAILER_SIZE)
+            || !deflate_scan_f(data + ZLIB_HEADER_SIZE, e->size - ZLIB_HEADER_SIZE - ZLIB_TRAILER_SIZE, bits + (i << 1), bits + (i << 1) + 1)) {
+            free((void*)bits);
+            napi_throw_error(env, nullptr, "Invalid compressed chunk: data probably corrupted.");
+            return false;
+        }
+        total_bits += deflate_align_bits_f(total_bits) + bits[(i << 1) + 1];
+    }
+
+    size_t header_len = gzip ? GZIP_HEADER_SIZE : ZLIB_HEADER_SIZE;
+    size_t body_len = (total_bits + 7) >> 3;
+    size_t out_len = header_len + body_len + (gzip ? GZIP_TRAILER_SIZE : ZLIB_TRAILER_SIZE);
+
+    uint8_t* out = nullptr;
+    status = napi_create_buffer(env, out_len, (void**)&out, result);
+    if ((status != napi_ok) || (out == nullptr)) {
+        free((void*)bits);
+        napi_throw_error(env, nullptr, "Cannot allocate buffer.");
+        return false;
+    }
+    memset(out, 0, out_len);
+
+    if (gzip) {
+        static const uint8_t gzip_header[GZIP_HEADER_SIZE] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+        memcpy(out, gzip_header, GZIP_HEADER_SIZE);
+    } else {
+        memcpy(out, entry_body_f(dbc, entries[0]), ZLIB_HEADER_SIZE);
+    }
+
+    uint8_t* body = out + header_len;
+    size_t bit = 0;
+    uint32_t check = gzip ? 0 : 1;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        db_entry_t* e = entries[i];
+        const uint8_t* data = entry_body_f(dbc, e);
+
+        if (bit & 7) {
+            // BFINAL = 0, BTYPE = 00 are already zero bits, then LEN = 0, NLEN = 0xffff
+            bit += deflate_align_bits_f(bit);
+            body[(bit >> 3) - 2] = 0xff;
+            body[(bit >> 3) - 1] = 0xff;
+        }
+
+        size_t start = bit >> 3;
+        size_t end_bit = bits[(i << 1) + 1];
+        memcpy(body + start, data + ZLIB_HEADER_SIZE, (end_bit + 7) >> 3);
+        if (end_bit & 7) {
+            // drop the padding after the end of the stream
+            body[start + (end_bit >> 3)] &= (uint8_t)((1 << (end_bit & 7)) - 1);
+        }
+        if (i + 1 < count) {
+            size_t final_bit = bits[i << 1];
+            body[start + (final_bit >> 3)] &= (uint8_t)~(1 << (final_bit & 7));
+        }
+        bit += end_bit;
+
+        if (gzip) {
+            // zlib trailers carry adler32; crc32 needs the data, which is still far cheaper than recompressing it
+            uint8_t scratch[ENTRY_MAX_SIZE_BYTES];
+            if ((e->len > sizeof(scratch)) || (decompress_f(data, e->size, scratch, e->len) != e->len)) {
+                free((void*)bits);
+                napi_throw_error(env, nullptr, "Invalid compressed chunk: data probably corrupted.");
+                return false;
+            }
+            check = libdeflate_crc32(check, scratch, e->len);
+        } else {
+            const uint8_t* adler = data + e->size - ZLIB_TRAILER_SIZE;
+            check = adler32_combine_f(check, (adler[0] << 24) | (adler[1] << 16) | (adler[2] << 8) | adler[3], e->len);
+        }
+    }
+
+    uint8_t* trailer = body + body_len;
+    if (gzip) {
+        for (int i = 0; i < 4; ++i) {
+            trailer[i] = (uint8_t)(check >> (i << 3));
+            trailer[i + 4] = (uint8_t)(data_length >> (i << 3));
+        }
+    } else {
+        for (int i = 0; i < 4; ++i) {
+            trailer[i] = (uint8_t)(check >> ((3 - i) << 3));
+        }
+    }
+
+    free((void*)bits);
+    return true;
+}
+
+// the stored zlib stream of every chunk, as zero-copy buffers
+bool db_chunk_buffers_f(napi_env env, db_wrapper_t* dbc, db_entry_t** entries, uint32_t count, napi_value* result)
+{
+    status = napi_create_array_with_length(env, count, result);
+    for (uint32_t i = 0; (status == napi_ok) && (i < count); ++i) {
+        const uint8_t* data = entry_body_f(dbc, entries[i]);
+        if (data == nullptr) {
+            napi_throw_error(env, nullptr, "Invalid entry: data probably corrupted.");
+            return false;
+        }
+        napi_value buffer;
+        status = napi_create_external_buffer(env, entries[i]->size, (void*)data, nullptr, nullptr, &buffer);
+        if (status == napi_ok) {
+            status = napi_set_element(env, *result, i, buffer);
+        }
+    }
+    if (status != napi_ok) {
+        napi_throw_error(env, nullptr, error_texts[status]);
+        return false;
+    }
+    return true;
+}
+
+bool db_serve_compressed_f(napi_env env, db_wrapper_t* dbc, db_entry_t** entries, uint32_t count, uint32_t data_length, int format, napi_value* result)
+{
+    if (format == COMPRESSED_FORMAT_CHUNKS) {
+        return db_chunk_buffers_f(env, dbc, entries, count, result);
+    } else {
+        return db_stitch_f(env, dbc, entries, count, data_length, format == COMPRESSED_FORMAT_GZIP, result);
+    }
+}
+
+typedef struct db_verify_job {
+    db_t* RO;
+    const db_entry_array_t* array;
+    const uint8_t* data;
+    uint32_t sample;
+    uint32_t offset;
+    bool failed;
+} db_verify_job_t;
+
+// n counts sampled chunks only
+void db_verify_chunk_f(void* job_ptr, uint32_t n)
+{
+    db_verify_job_t* job = (db_verify_job_t*)job_ptr;
+    uint32_t i = job->offset + n * job->sample;
+    db_entry_t* e = bucket_to_entry_f(job->RO, job->array->buckets[i]);
+    size_t offset = ((size_t)i) << ENTRY_MAX_SIZE_SHIFT;
+    uint8_t hash[BLAKE3_OUT_LEN];
+    if (offset + e->len > job->array->data_length) {
+        job->failed = true;
+        return;
+    }
+    blake3_hash(job->data + offset, e->len, hash);
+    if (memcmp(hash, e->hash, BLAKE3_OUT_LEN)) {
+        job->failed = true;
+    }
+}
+
+// rechecks the hashes of a decompressed chunked value
+bool db_verify_array_f(db_wrapper_t* db, db_t* RO, db_entry_t* entry, const db_entry_array_t* array, const uint8_t* data)
+{
+    db_verify_job_t job = { RO, array, data, db->verify_sample, (uint32_t)rand() % db->verify_sample, false };
+
+    if (db->verify == VERIFY_FULL) {
+        uint8_t hash[BLAKE3_OUT_LEN];
+        blake3_hash((const uint8_t*)array, entry->len, hash);
+        if (memcmp(hash, entry->hash, BLAKE3_OUT_LEN)) {
+            // not keyed by its chunk list, so it must be keyed by its content
+            blake3_hash_parallel_f(data, array->data_length, db->threads, hash);
+            return !memcmp(hash, entry->hash, BLAKE3_OUT_LEN);
+        }
+        job.sample = 1;
+        job.offset = 0;
+    }
+
+    uint32_t count = job.offset < array->array_length ? (array->array_length - job.offset - 1) / job.sample + 1 : 0;
+    // as in blake3_hash_parallel_f, small jobs do not pay for starting threads
+    uint32_t threads = ((size_t)count << ENTRY_MAX_SIZE_SHIFT) < BLAKE3_PARALLEL_MIN_BYTES ? 1 : db->threads;
+    parallel_for_f(threads, count, db_verify_chunk_f, (void*)&job);
+
+    return !job.failed;
+}
+
+napi_value dbm_fetch_f(napi_env env, napi_callback_info info)
+{
+    napi_value ret;
+    napi_get_undefined(env, &ret);
+    errcheckd();
+
+    genv = env;
+
+    napi_value thisarg;
+    napi_value argv[4];
+    size_t argc = 4;
+
+    db_wrapper_t* db = nullptr;
+
+    status = napi_get_cb_info(env, info, &argc, argv, &thisarg, (void**)&db);
+    errcheckd();
+
+    if (db == nullptr) {
+        napi_throw_error(env, nullptr, "Invalid callback.");
+        return ret;
+    }
+
+    uint8_t hashstr[BLAKE3_OUT_LEN * 2 + 1] = "";
+    size_t hashstr_len = 0;
+
+    status = napi_get_value_string_latin1(env, argv[0], (char*)hashstr, sizeof(hashstr), &hashstr_len);
+    errcheck("Hash must be a string.");
+
+    bool do_decompress = false;
+    status = napi_get_value_bool(env, argv[1], &do_decompress);
+    // ignore invalid type, default to false
+
+    bool do_dereference = false;
+    status = napi_get_value_bool(env, argv[2], &do_dereference);
+    // ignore invalid type, default to false
+
+    char formatstr[8] = "";
+    size_t formatstr_len = 0;
+    int format = COMPRESSED_FORMAT_ZLIB;
+    status = napi_get_value_string_latin1(env, argv[3], formatstr, sizeof(formatstr), &formatstr_len);
+    // ignore invalid type, default to zlib
+    if (status == napi_ok) {
+        if (!strcmp(formatstr, "gzip")) {
+            format = COMPRESSED_FORMAT_GZIP;
+        } else if (!strcmp(formatstr, "chunks")) {
+            format = COMPRESSED_FORMAT_CHUNKS;
+        } else if (strcmp(formatstr, "zlib")) {
+            napi_throw_error(env, nullptr, "Compressed format must be one of 'zlib', 'gzip' or 'chunks'.");
+            return ret;
+        }
+    }
+
+    hash_from_string_f(hashstr);
+
+    if (!memcmp(hashstr, DATA_ID_KEY, BLAKE3_OUT_LEN)) {
+        // reserved for the data file record
+        return ret;
+    }
+
+    for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->rodb) {
+        uint32_t bucket_index = ((*((uint32_t*)hashstr)) % (dbc->RO->size >> INDEX_SIZE_SHIFT));
+        uint32_t bucket = dbc->RO->buckets[bucket_index];
+
+        while (bucket != 0) {
+
+            db_entry_t* entry = bucket_to_entry_f(dbc->RO, bucket);
+
+            if (!memcmp(entry->hash, hashstr, BLAKE3_OUT_LEN)) {
+                if (do_dereference) {
+                    if (entry->val) {
+                        bucket = entry->val;
+                        entry = bucket_to_entry_f(dbc->RO, entry->val);
+                    } else {
+                        break;
+                    }
+                }
+                if (!strcmp(entry->magic, DB_ENTRY_ARRAY_MAGIC_NUMBER)) {
+                    db_entry_array_t* array = (db_entry_array_t*)calloc(1, entry->len);
+                    malloc_failed_check(array);
+                    const uint8_t* data = entry_body_f(dbc, entry);
+                    if ((data == nullptr) || (decompress_f(data, entry->size, (uint8_t*)array, entry->len) < sizeof(db_entry_array_t))) {
+                        napi_throw_error(env, nullptr, "Invalid entry array.");
+                        free((void*)array);
+                        return ret;
+                    }
+
+                    if ((array->array_length == 0) || (array->array_length > ((entry->len - sizeof(db_entry_array_t)) / sizeof(uint32_t)))) {
+                        napi_throw_error(env, nullptr, "Invalid entry array.");
+                        free((void*)array);
+                        return ret;
+                    }
+
+                    if (!do_decompress) {
+                        db_entry_t** entries = (db_entry_t**)malloc(sizeof(db_entry_t*) * array->array_length);
+                        if (entries == nullptr) {
+                            free((void*)array);
+                            napi_throw_error(env, nullptr, "Out of memory");
+                            return ret;
+                        }
+                        for (uint32_t i = 0; i < array->array_length; ++i) {
+                            entries[i] = bucket_to_entry_f(dbc->RO, array->buckets[i]);
+                        }
+                        db_serve_compressed_f(env, dbc, entries, array->array_length, array->data_length, format, &ret);
+                        free((void*)entries);
+                        free((void*)array);
+                        return ret;
+                    }
+
+                    uint8_t* decompressed = nullptr;
+                    uint32_t len_already_read = 0;
+                    status = napi_create_buffer(env, array->data_length, (void**)&decompressed, &ret);
+                    if ((status != napi_ok) || (decompressed == nullptr)) {
+                        free((void*)array);
+                        napi_throw_error(env, nullptr, "Cannot allocate buffer.");
+                        return ret;
+                    }
+                    for (uint32_t i = 0; i < array->array_length; ++i) {
+                        db_entry_t* e = bucket_to_entry_f(dbc->RO, array->buckets[i]);
+                        if (array->data_length < (len_already_read + e->len)) {
+                            napi_throw_error(env, nullptr, "Invalid entry array.");
+                            free((void*)array);
+                            return ret;
+                        }
+                        const uint8_t* e_data = entry_body_f(dbc, e);
+                        if (e_data == nullptr) {
+                            napi_throw_error(env, nullptr, "Invalid entry: data probably corrupted.");
+                            free((void*)array);
+                            return ret;
+                        }
+                        len_already_read += decompress_f(e_data, e->size, decompressed + len_already_read, array->data_length - len_already_read);
+                    }
+
+                    if ((db->verify != VERIFY_NONE) && !db_verify_array_f(db, dbc->RO, entry, array, decompressed)) {
+                        napi_throw_error(env, nullptr, "Verification failed: data probably corrupted.");
+                        free((void*)array);
+                        return ret;
+                    }
+
+                    free((void*)array);
+                } else {
+                    const uint8_t* data = entry_body_f(dbc, entry);
+                    if (data == nullptr) {
+                        napi_throw_error(env, nullptr, "Invalid entry: data probably corrupted.");
+                        return ret;
+                    }
+                    if (do_decompress) {
+                        uint8_t* decompressed = nullptr;
+                        status = napi_create_buffer(env, entry->len, (void**)&decompressed, &ret);
+                        malloc_failed_check(decompressed);
+                        errcheckd();
+                        decompress_f(data, entry->size, decompressed, entry->len);
+                        if ((db->verify == VERIFY_FULL) || ((db->verify == VERIFY_SAMPLED) && ((rand() % db->verify_sample) == 0))) {
+                            uint8_t hash[BLAKE3_OUT_LEN];
+                            blake3_hash(decompressed, entry->len, hash);
+                            if (memcmp(hash, entry->hash, BLAKE3_OUT_LEN)) {
+                                napi_throw_error(env, nullptr, "Verification failed: data probably corrupted.");
+                                return ret;
+                            }
+                        }
+                    } else if (format == COMPRESSED_FORMAT_ZLIB) {
+                        status = napi_create_external_buffer(env, entry->size, (void*)data, nullptr, nullptr, &ret);
+                        errcheckd();
+                    } else {
+                        db_serve_compressed_f(env, dbc, &entry, 1, entry->len, format, &ret);
+                    }
+                }
+                return ret;
+            } else {
+                bucket = entry->next;
+            }
+        }
+    }
+
+    return ret;
+}
+
+napi_value dbm_associate_f(napi_env env, napi_callback_info info)
+{
+    napi_value ret;
+
+    status = napi_get_boolean(env, true, &ret);
+
+    napi_value thisarg;
+    napi_value argv[2];
+    size_t argc = 2;
+
+    db_wrapper_t* db = nullptr;
+
+    status = napi_get_cb_info(env, info, &argc, argv, &thisarg, (void**)&db);
+    errcheckd();
+
+    if (db == nullptr) {
+        napi_throw_error(env, nullptr, "Invalid callback.");
+        return ret;
+    }
+
+    uint8_t* key_data = nullptr;
+    size_t key_len = 0;
+
+    status = napi_get_buffer_info(env, argv[0], (void**)&key_data, &key_len);
+    errcheckd();
+
+    uint8_t* val_data = nullptr;
+    size_t val_len = 0;
+
+    status = napi_get_buffer_info(env, argv[1], (void**)&val_data, &val_len);
+    errcheckd();
+
+    if ((key_len > VALUE_MAX_SIZE_BYTES) || (val_len > VALUE_MAX_SIZE_BYTES)) {
+        napi_throw_error(env, nullptr, "db.set(): Value too large");
+        return ret;
+    }
+
+    uint32_t key = dbw_insert_buffer_f(db, key_data, key_len);
+
+    if (key == 0) {
+        napi_get_boolean(env, false, &ret);
+        return ret;
+    }
+
+    uint32_t val = val_data ? val_len ? dbw_insert_buffer_f(db, val_data, val_len) : 0 : 0;
+
+    for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->copy) {
+        db_entry_t* entry = bucket_to_entry_f(dbc->RW, key);
+
+        entry->val = val;
+    }
+
+    return ret;
+}
+
+typedef struct db_batch {
+    db_wrapper_t* db;
+    napi_async_work work;
+    napi_deferred deferred;
+    napi_ref values; // keeps the input buffers alive
+    napi_ref owner; // keeps the object holding db's query, and so db, alive
+    uint32_t count;
+    uint32_t jobs;
+    uint32_t* lengths;
+    uint32_t* first_chunk; // count + 1 entries
+    uint32_t chunk_count;
+    uint32_t next_chunk;
+    uint32_t prepared;
+    const uint8_t** sources;
+    db_prepared_chunk_t* chunks;
+    uint8_t* content_hashes; // count * BLAKE3_OUT_LEN in content addressing mode, else nullptr
+} db_batch_t;
+
+void db_batch_free_f(napi_env env, db_batch_t* batch)
+{
+    if (batch->values != nullptr) {
+        napi_delete_reference(env, batch->values);
+    }
+    if (batch->owner != nullptr) {
+        napi_delete_reference(env, batch->owner);
+    }
+    if (batch->work != nullptr) {
+        napi_delete_async_work(env, batch->work);
+    }
+    free((void*)batch->lengths);
+    free((void*)batch->first_chunk);
+    free((void*)batch->sources);
+    free((void*)batch->chunks);
+    free((void*)batch->content_hashes);
+    free((void*)batch);
+}
+
+void* db_batch_worker_f(void* batch_ptr)
+{
+    db_batch_t* batch = (db_batch_t*)batch_ptr;
+
+    struct libdeflate_compressor* c = libdeflate_alloc_compressor(USED_COMPRESSION_LEVEL);
+    if (c == NULL) {
+        // the other workers pick up the slack
+        return nullptr;
+    }
+
+    uint32_t i;
+    while ((i = __atomic_fetch_add(&batch->next_chunk, 1, __ATOMIC_RELAXED)) < batch->chunk_count) {
+        if (db_prepare_chunk_f(c, batch->sources[i], batch->chunks[i].len, batch->chunks + i)) {
+            __atomic_fetch_add(&batch->prepared, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    libdeflate_free_compressor(c);
+    return nullptr;
+}
+
+void db_batch_hash_f(void* batch_ptr, uint32_t i)
+{
+    db_batch_t* batch = (db_batch_t*)batch_ptr;
+    if ((batch->lengths[i] > ENTRY_MAX_SIZE_BYTES) && (batch->lengths[i] < BLAKE3_PARALLEL_MIN_BYTES)) {
+        blake3_hash(batch->sources[batch->first_chunk[i]], batch->lengths[i], batch->content_hashes + (size_t)i * BLAKE3_OUT_LEN);
+    }
+}
+
+// runs on the libuv threadpool, fans out to batch->jobs threads
+void db_batch_execute_f(napi_env env, void* batch_ptr)
+{
+    (void)env;
+    db_batch_t* batch = (db_batch_t*)batch_ptr;
+
+    uint32_t jobs = batch->jobs < batch->chunk_count ? batch->jobs : batch->chunk_count;
+    pthread_t* threads = jobs > 1 ? (pthread_t*)calloc(jobs - 1, sizeof(pthread_t)) : nullptr;
+    uint32_t started = 0;
+
+    for (uint32_t i = 1; (threads != nullptr) && (i < jobs); ++i) {
+        if (!pthread_create(threads + started, nullptr, db_batch_worker_f, batch_ptr)) {
+            ++started;
+        }
+    }
+
+    db_batch_worker_f(batch_ptr);
+
+    for (uint32_t i = 0; i < started; ++i) {
+        pthread_join(threads[i], nullptr);
+    }
+
+    free((void*)threads);
+
+    if (batch->content_hashes != nullptr) {
+        // many small values hash side by side, large ones spread across all threads
+        parallel_for_f(batch->jobs, batch->count, db_batch_hash_f, batch_ptr);
+        for (uint32_t i = 0; i < batch->count; ++i) {
+            if (batch->lengths[i] >= BLAKE3_PARALLEL_MIN_BYTES) {
+                blake3_hash_parallel_f(batch->sources[batch->first_chunk[i]], batch->lengths[i], batch->jobs, batch->content_hashes + (size_t)i * BLAKE3_OUT_LEN);
+            }
+        }
+    }
+}
+
+// runs on the main thread, appends the prepared chunks in input order
+void db_batch_complete_f(napi_env env, napi_status work_status, void* batch_ptr)
+{
+    db_batch_t* batch = (db_batch_t*)batch_ptr;
+
+    genv = env;
+
+    napi_value result = nullptr;
+
+    if ((work_status != napi_ok) || (batch->prepared != batch->chunk_count)) {
+        napi_throw_error(env, nullptr, "storeMany(): compression failed");
+    } else if (napi_create_array_with_length(env, batch->count, &result) == napi_ok) {
+        for (uint32_t i = 0; i < batch->count; ++i) {
+            napi_value hash;
+            if (batch->lengths[i] == 0) {
+                napi_create_string_latin1(env, "", 0, &hash);
+            } else {
+                uint32_t bucket = dbw_insert_prepared_buffer_f(batch->db, batch->chunks + batch->first_chunk[i], batch->lengths[i],
+                    batch->content_hashes ? batch->content_hashes + (size_t)i * BLAKE3_OUT_LEN : nullptr);
+                if (bucket == 0) {
+                    // something went wrong, and we probably already threw
+                    break;
+                }
+                hash_to_string_f(env, bucket_to_entry_f(batch->db->RO, bucket)->hash, &hash);
+            }
+            napi_set_element(env, result, i, hash);
+        }
+    }
+
+    bool pending = false;
+    napi_is_exception_pending(env, &pending);
+    if (pending || (result == nullptr)) {
+        napi_value error;
+        if (!pending) {
+            napi_throw_error(env, nullptr, "storeMany(): could not create result");
         }
-        return arr_bucket;
+        napi_get_and_clear_last_exception(env, &error);
+        napi_reject_deferred(env, batch->deferred, error);
+    } else {
+        napi_resolve_deferred(env, batch->deferred, result);
     }
+
+    db_batch_free_f(env, batch);
 }
 
-napi_value dbm_store_f(napi_env env, napi_callback_info info)
+napi_value dbm_store_many_f(napi_env env, napi_callback_info info)
 {
     napi_value ret;
     napi_get_undefined(env, &ret);
@@ -380,77 +2112,132 @@ napi_value dbm_store_f(napi_env env, napi_callback_info info)
     genv = env;
 
     napi_value thisarg;
-    napi_value argv[1];
-    size_t argc = 1;
-
-    status = napi_get_cb_info(env, info, &argc, argv, &thisarg, nullptr);
-    errcheck("Could not read function arguments");
+    napi_value argv[2];
+    size_t argc = 2;
 
-    napi_value query;
-    napi_get_named_property(env, thisarg, "query", &query);
-    errcheck("store() called with invalid thisArg");
+    db_wrapper_t* db = nullptr;
 
-    bool query_is_buffer;
-    status = napi_is_buffer(env, query, &query_is_buffer);
+    status = napi_get_cb_info(env, info, &argc, argv, &thisarg, (void**)&db);
     errcheckd();
-    if (query_is_buffer == false) {
-        napi_throw_error(env, nullptr, "db.query is invalid.");
+
+    if (db == nullptr) {
+        napi_throw_error(env, nullptr, "Invalid callback.");
         return ret;
     }
 
-    db_wrapper_t* db = nullptr;
-    size_t query_length = 0;
-    napi_get_buffer_info(env, query, (void**)&db, &query_length);
-    errcheck("Could not get db_wrapper from query");
-    if (db == nullptr) {
-        napi_throw_error(env, nullptr, "db.query has null pointer");
+    bool is_array = false;
+    status = napi_is_array(env, argv[0], &is_array);
+    if ((status != napi_ok) || !is_array) {
+        napi_throw_error(env, nullptr, "storeMany(): expected an array of buffers");
         return ret;
     }
 
-    uint8_t* buffer_data = nullptr;
-    size_t buffer_length = 0;
+    db_batch_t* batch = (db_batch_t*)calloc(1, sizeof(db_batch_t));
+    malloc_failed_check(batch);
 
-    napi_get_buffer_info(env, argv[0], (void**)&buffer_data, &buffer_length);
-    errcheck("db.store(): Could not get data from buffer.");
+    batch->db = db;
 
-    if (buffer_data == nullptr) {
-        napi_throw_error(env, nullptr, "db.store(): buffer_data is null");
+    status = napi_get_array_length(env, argv[0], &batch->count);
+    if (status != napi_ok) {
+        db_batch_free_f(env, batch);
+        napi_throw_error(env, nullptr, "storeMany(): could not read array");
         return ret;
     }
 
-    uint32_t bucket = 0;
+    status = napi_get_value_uint32(env, argv[1], &batch->jobs);
+    // ignore invalid type, default to one job per core
+    if ((status != napi_ok) || (batch->jobs == 0)) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        batch->jobs = cores > 0 ? (uint32_t)cores : 1;
+    }
 
-    if (buffer_length != 0) {
-        bucket = dbw_insert_buffer_f(db, buffer_data, buffer_length);
+    batch->lengths = (uint32_t*)calloc(batch->count + 1, sizeof(uint32_t));
+    batch->first_chunk = (uint32_t*)calloc(batch->count + 1, sizeof(uint32_t));
+    uint8_t** data = (uint8_t**)calloc(batch->count + 1, sizeof(uint8_t*));
+    if ((batch->lengths == nullptr) || (batch->first_chunk == nullptr) || (data == nullptr)) {
+        free((void*)data);
+        db_batch_free_f(env, batch);
+        napi_throw_error(env, nullptr, "Out of memory");
+        return ret;
     }
 
-    if (bucket != 0) {
-        db_entry_t* entry = bucket_to_entry_f(db->RO, bucket);
-        char* strhash = (char*)malloc(BLAKE3_OUT_LEN << 1);
-        malloc_failed_check(strhash);
-        for (int i = 0; i < BLAKE3_OUT_LEN; ++i) {
-            strhash[(i << 1) + 0] = "0123456789abcdef"[entry->hash[i] >> 4];
-            strhash[(i << 1) + 1] = "0123456789abcdef"[entry->hash[i] & 15];
-        }
-        napi_create_string_latin1(env, strhash, BLAKE3_OUT_LEN << 1, &ret);
-        free((void*)strhash);
-        errcheckd();
+    for (uint32_t i = 0; i < batch->count; ++i) {
+        napi_value value;
+        size_t length = 0;
+        status = napi_get_element(env, argv[0], i, &value);
+        if (status == napi_ok) {
+            status = napi_get_buffer_info(env, value, (void**)(data + i), &length);
+        }
+        if ((status != napi_ok) || (length > VALUE_MAX_SIZE_BYTES)) {
+            free((void*)data);
+            db_batch_free_f(env, batch);
+            napi_throw_error(env, nullptr, "storeMany(): values must be buffers of at most DB_VALUE_MAX_SIZE bytes");
+            return ret;
+        }
+        batch->lengths[i] = (uint32_t)length;
+        batch->first_chunk[i] = batch->chunk_count;
+        batch->chunk_count += length ? ((length - 1) >> ENTRY_MAX_SIZE_SHIFT) + 1 : 0;
+    }
+    batch->first_chunk[batch->count] = batch->chunk_count;
+
+    batch->sources = (const uint8_t**)calloc(batch->chunk_count + 1, sizeof(uint8_t*));
+    batch->chunks = (db_prepared_chunk_t*)malloc(((size_t)batch->chunk_count + 1) * sizeof(db_prepared_chunk_t));
+    if (db->content_addressing) {
+        batch->content_hashes = (uint8_t*)malloc(((size_t)batch->count + 1) * BLAKE3_OUT_LEN);
+    }
+    if ((batch->sources == nullptr) || (batch->chunks == nullptr) || (db->content_addressing && (batch->content_hashes == nullptr))) {
+        free((void*)data);
+        db_batch_free_f(env, batch);
+        napi_throw_error(env, nullptr, "Out of memory");
+        return ret;
+    }
+
+    for (uint32_t i = 0; i < batch->count; ++i) {
+        for (uint32_t j = batch->first_chunk[i]; j < batch->first_chunk[i + 1]; ++j) {
+            uint32_t offset = (j - batch->first_chunk[i]) << ENTRY_MAX_SIZE_SHIFT;
+            uint32_t chunk_len = batch->lengths[i] - offset;
+            batch->sources[j] = data[i] + offset;
+            batch->chunks[j].len = chunk_len > ENTRY_MAX_SIZE_BYTES ? ENTRY_MAX_SIZE_BYTES : chunk_len;
+        }
+    }
+    free((void*)data);
+
+    napi_value resource_name;
+    status = napi_create_reference(env, argv[0], 1, &batch->values);
+    if (status == napi_ok) {
+        // db_destroy_f would unmap the files under the workers
+        status = napi_create_reference(env, thisarg, 1, &batch->owner);
+    }
+    if (status == napi_ok) {
+        status = napi_create_string_utf8(env, "storeMany", NAPI_AUTO_LENGTH, &resource_name);
+    }
+    if (status == napi_ok) {
+        status = napi_create_async_work(env, nullptr, resource_name, db_batch_execute_f, db_batch_complete_f, (void*)batch, &batch->work);
+    }
+    if (status == napi_ok) {
+        status = napi_create_promise(env, &batch->deferred, &ret);
+    }
+    if (status == napi_ok) {
+        status = napi_queue_async_work(env, batch->work);
+    }
+    if (status != napi_ok) {
+        db_batch_free_f(env, batch);
+        napi_throw_error(env, nullptr, error_texts[status]);
     }
 
     return ret;
 }
 
-napi_value dbm_fetch_f(napi_env env, napi_callback_info info)
+napi_value dbm_has_f(napi_env env, napi_callback_info info)
 {
     napi_value ret;
-    napi_get_undefined(env, &ret);
-    errcheckd();
+    napi_get_boolean(env, false, &ret);
 
     genv = env;
 
     napi_value thisarg;
-    napi_value argv[3];
-    size_t argc = 3;
+    napi_value argv[1];
+    size_t argc = 1;
 
     db_wrapper_t* db = nullptr;
 
@@ -468,119 +2255,37 @@ napi_value dbm_fetch_f(napi_env env, napi_callback_info info)
     status = napi_get_value_string_latin1(env, argv[0], (char*)hashstr, sizeof(hashstr), &hashstr_len);
     errcheck("Hash must be a string.");
 
-    bool do_decompress = false;
-    status = napi_get_value_bool(env, argv[1], &do_decompress);
-    // ignore invalid type, default to false
+    if (hashstr_len != (BLAKE3_OUT_LEN << 1)) {
+        return ret;
+    }
 
-    bool do_dereference = false;
-    status = napi_get_value_bool(env, argv[2], &do_dereference);
-    // ignore invalid type, default to false
+    hash_from_string_f(hashstr);
 
-    for (int i = 0; i < 32; ++i) {
-        uint8_t c = hashstr[(i << 1) + 0];
-        if (c >= 'a') {
-            c -= 'a' - 10;
-        } else if (c >= 'A') {
-            c -= 'A' - 10;
-        } else if (c >= '0') {
-            c -= '0';
-        }
-        uint8_t d = hashstr[(i << 1) + 1];
-        if (d >= 'a') {
-            d -= 'a' - 10;
-        } else if (d >= 'A') {
-            d -= 'A' - 10;
-        } else if (d >= '0') {
-            d -= '0';
-        }
-        hashstr[i] = (c << 4) | d;
+    if (!memcmp(hashstr, DATA_ID_KEY, BLAKE3_OUT_LEN)) {
+        // reserved for the data file record
+        return ret;
     }
 
     for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->rodb) {
-        uint32_t bucket_index = ((*((uint32_t*)hashstr)) % (dbc->RO->size >> INDEX_SIZE_SHIFT));
-        uint32_t bucket = dbc->RO->buckets[bucket_index];
-
-        while (bucket != 0) {
-
-            db_entry_t* entry = bucket_to_entry_f(dbc->RO, bucket);
-
-            if (!memcmp(entry->hash, hashstr, BLAKE3_OUT_LEN)) {
-                if (do_dereference) {
-                    if (entry->val) {
-                        bucket = entry->val;
-                        entry = bucket_to_entry_f(dbc->RO, entry->val);
-                    } else {
-                        break;
-                    }
-                }
-                if (!strcmp(entry->magic, DB_ENTRY_ARRAY_MAGIC_NUMBER)) {
-                    db_entry_array_t* array = (db_entry_array_t*)calloc(1, entry->len);
-                    malloc_failed_check(array);
-                    if (decompress_f(entry->data, entry->size, (uint8_t*)array, entry->len) < sizeof(db_entry_array_t)) {
-                        napi_throw_error(env, nullptr, "Invalid entry array.");
-                        free((void*)array);
-                        return ret;
-                    }
-
-                    uint8_t* decompressed = nullptr;
-                    uint32_t len_already_read = 0;
-                    status = napi_create_buffer(env, array->data_length, (void**)&decompressed, &ret);
-                    if ((status != napi_ok) || (decompressed == nullptr)) {
-                        free((void*)array);
-                        napi_throw_error(env, nullptr, "Cannot allocate buffer.");
-                        return ret;
-                    }
-                    for (uint32_t i = 0; i < array->array_length; ++i) {
-                        db_entry_t* e = bucket_to_entry_f(dbc->RO, array->buckets[i]);
-                        if (array->data_length < (len_already_read + e->len)) {
-                            napi_throw_error(env, nullptr, "Invalid entry array.");
-                            free((void*)array);
-                            return ret;
-                        }
-                        len_already_read += decompress_f(e->data, e->size, decompressed + len_already_read, array->data_length - len_already_read);
-                    }
-
-                    if (!do_decompress) {
-                        void* compressed = malloc(len_already_read);
-                        uint32_t compressed_len = compress_f(decompressed, array->data_length, compressed, len_already_read);
-                        void* compressed_buffer = nullptr;
-
-                        status = napi_create_buffer_copy(env, compressed_len, (void*)compressed, &compressed_buffer, &ret);
-                        free(compressed);
-                    }
-
-                    free((void*)array);
-                } else {
-                    if (do_decompress) {
-                        uint8_t* decompressed = nullptr;
-                        status = napi_create_buffer(env, entry->len, (void**)&decompressed, &ret);
-                        malloc_failed_check(decompressed);
-                        errcheckd();
-                        decompress_f(entry->data, entry->size, decompressed, entry->len);
-                    } else {
-                        status = napi_create_external_buffer(env, entry->size, entry->data, nullptr, nullptr, &ret);
-                        errcheckd();
-                    }
-                }
-                return ret;
-            } else {
-                bucket = entry->next;
-            }
+        if (db_find_chunk_by_hash_f(dbc->RO, hashstr) != 0) {
+            napi_get_boolean(env, true, &ret);
+            break;
         }
     }
 
     return ret;
 }
 
-napi_value dbm_associate_f(napi_env env, napi_callback_info info)
+// the key a value is stored under in content addressing mode
+napi_value dbm_hash_f(napi_env env, napi_callback_info info)
 {
     napi_value ret;
-
-    status = napi_get_boolean(env, true, &ret);
+    napi_get_undefined(env, &ret);
+    errcheckd();
 
     napi_value thisarg;
-    napi_value argv[2];
-    size_t argc = 2;
+    napi_value argv[1];
+    size_t argc = 1;
 
     db_wrapper_t* db = nullptr;
 
@@ -592,33 +2297,18 @@ napi_value dbm_associate_f(napi_env env, napi_callback_info info)
         return ret;
     }
 
-    uint8_t* key_data = nullptr;
-    size_t key_len = 0;
-
-    status = napi_get_buffer_info(env, argv[0], (void**)&key_data, &key_len);
-    errcheckd();
-
-    uint32_t key = dbw_insert_buffer_f(db, key_data, key_len);
+    uint8_t* data = nullptr;
+    size_t length = 0;
 
-    if (key == 0) {
-        napi_get_boolean(env, false, &ret);
-        return ret;
-    }
+    status = napi_get_buffer_info(env, argv[0], (void**)&data, &length);
+    errcheck("db.hash(): Could not get data from buffer.");
 
-    uint8_t* val_data = nullptr;
-    size_t val_len = 0;
+    uint8_t hash[BLAKE3_OUT_LEN];
+    blake3_hash_parallel_f(data, length, db->threads, hash);
 
-    status = napi_get_buffer_info(env, argv[1], (void**)&val_data, &val_len);
+    status = hash_to_string_f(env, hash, &ret);
     errcheckd();
 
-    uint32_t val = val_data ? val_len ? dbw_insert_buffer_f(db, val_data, val_len) : 0 : 0;
-
-    for (db_wrapper_t* dbc = db; dbc != nullptr; dbc = dbc->copy) {
-        db_entry_t* entry = bucket_to_entry_f(dbc->RW, key);
-
-        entry->val = val;
-    }
-
     return ret;
 }
 
@@ -633,6 +2323,8 @@ napi_value db_init_f(napi_env env, napi_callback_info info)
     status = napi_get_cb_info(env, info, &argc, argv, &thisarg, nullptr);
     errcheckd();
 
+    genv = env;
+
     if (!argc) {
         napi_throw_error(env, nullptr, "Database constructor must be passed a valid options object.");
     }
@@ -655,17 +2347,118 @@ napi_value db_init_f(napi_env env, napi_callback_info info)
     errcheck("Database options must include a field named 'size'");
 
     db_wrapper_t* db = db_alloc_f(storage_file_name, (ssize_t)storage_file_size, false);
+    if (db == nullptr) {
+        napi_throw_error(env, nullptr, "Could not open 'storage_file'");
+        return ret;
+    }
 
     napi_value tmp;
+    status = napi_get_named_property(env, argv[0], "content_addressing", &tmp);
+    errcheckd();
+
+    status = napi_get_value_bool(env, tmp, &db->content_addressing);
+    // ignore invalid type, default to false
+
+    status = napi_get_named_property(env, argv[0], "verify", &tmp);
+    errcheckd();
+
+    char verify[8] = "";
+    size_t verify_len = 0;
+    status = napi_get_value_string_latin1(env, tmp, verify, sizeof(verify), &verify_len);
+    // ignore invalid type, default to none
+    if (!strcmp(verify, "full")) {
+        db->verify = VERIFY_FULL;
+    } else if (!strcmp(verify, "sampled")) {
+        db->verify = VERIFY_SAMPLED;
+    }
+
+    status = napi_get_named_property(env, argv[0], "verify_sample", &tmp);
+    errcheckd();
+
+    status = napi_get_value_uint32(env, tmp, &db->verify_sample);
+    if ((status != napi_ok) || (db->verify_sample == 0)) {
+        db->verify_sample = 16;
+    }
+
+    status = napi_get_named_property(env, argv[0], "threads", &tmp);
+    errcheckd();
+
+    status = napi_get_value_uint32(env, tmp, &db->threads);
+    if ((status != napi_ok) || (db->threads == 0)) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        db->threads = cores > 0 ? (uint32_t)cores : 1;
+    }
+
+    int64_t data_file_size = storage_file_size;
+    status = napi_get_named_property(env, argv[0], "data_size", &tmp);
+    errcheckd();
+
+    status = napi_get_value_int64(env, tmp, &data_file_size);
+    if ((status != napi_ok) || (data_file_size <= 0)) {
+        data_file_size = storage_file_size;
+    }
+
+    status = napi_get_named_property(env, argv[0], "__data", &tmp);
+    errcheckd();
+
+    if (!db_alloc_data_list_f(env, tmp, db, storage_file_name, (ssize_t)data_file_size, false)) {
+        db_free_f(db);
+        return ret;
+    }
+
+    napi_value data_lists;
     status = napi_get_named_property(env, argv[0], "__copies", &tmp);
     errcheckd();
 
-    db_alloc_sub_f(env, tmp, db, (ssize_t)storage_file_size, false);
+    status = napi_get_named_property(env, argv[0], "__copies_data", &data_lists);
+    errcheckd();
+
+    if (!db_alloc_sub_f(env, tmp, data_lists, db, (ssize_t)storage_file_size, (ssize_t)data_file_size, false)) {
+        db_free_f(db);
+        return ret;
+    }
 
     status = napi_get_named_property(env, argv[0], "__rocopies", &tmp);
     errcheckd();
 
-    db_alloc_sub_f(env, tmp, db, (ssize_t)storage_file_size, true);
+    status = napi_get_named_property(env, argv[0], "__rocopies_data", &data_lists);
+    errcheckd();
+
+    if (!db_alloc_sub_f(env, tmp, data_lists, db, (ssize_t)storage_file_size, (ssize_t)data_file_size, true)) {
+        db_free_f(db);
+        return ret;
+    }
+
+    if (!dbw_init_data_f(db)) {
+        db_free_f(db);
+        return ret;
+    }
+
+    char advice[16] = "";
+    size_t advice_len = 0;
+
+    status = napi_get_named_property(env, argv[0], "index_advice", &tmp);
+    errcheckd();
+
+    status = napi_get_value_string_latin1(env, tmp, advice, sizeof(advice), &advice_len);
+    // ignore invalid type, default to the kernel's readahead
+    int index_advice = advice_from_string_f(status == napi_ok ? advice : "", -1);
+
+    status = napi_get_named_property(env, argv[0], "data_advice", &tmp);
+    errcheckd();
+
+    status = napi_get_value_string_latin1(env, tmp, advice, sizeof(advice), &advice_len);
+    // ignore invalid type; chunk bodies are read one at a time, so readahead is wasted on them
+    int data_advice = advice_from_string_f(status == napi_ok ? advice : "", MADV_RANDOM);
+
+    bool pin_index = false;
+    status = napi_get_named_property(env, argv[0], "pin_index", &tmp);
+    errcheckd();
+
+    status = napi_get_value_bool(env, tmp, &pin_index);
+    // ignore invalid type, default to false
+
+    db_advise_f(db, index_advice, data_advice, pin_index);
 
     status = napi_create_object(env, &ret);
     errcheckd();
@@ -698,6 +2491,27 @@ napi_value db_init_f(napi_env env, napi_callback_info info)
     status = napi_set_named_property(env, ret, "associate", associate_f);
     errcheckd();
 
+    napi_value store_many_f;
+    status = napi_create_function(env, "store_many", NAPI_AUTO_LENGTH, dbm_store_many_f, (void*)db, &store_many_f);
+    errcheckd();
+
+    status = napi_set_named_property(env, ret, "store_many", store_many_f);
+    errcheckd();
+
+    napi_value has_f;
+    status = napi_create_function(env, "has", NAPI_AUTO_LENGTH, dbm_has_f, (void*)db, &has_f);
+    errcheckd();
+
+    status = napi_set_named_property(env, ret, "has", has_f);
+    errcheckd();
+
+    napi_value hash_f;
+    status = napi_create_function(env, "hash", NAPI_AUTO_LENGTH, dbm_hash_f, (void*)db, &hash_f);
+    errcheckd();
+
+    status = napi_set_named_property(env, ret, "hash", hash_f);
+    errcheckd();
+
     return ret;
 }
 
@@ -711,6 +2525,13 @@ napi_value init(napi_env env, napi_value ret)
     status = napi_set_named_property(env, ret, "db_init", db_init);
     errcheckd();
 
+    napi_value value_max_size;
+    status = napi_create_int64(env, VALUE_MAX_SIZE_BYTES, &value_max_size);
+    errcheckd();
+
+    status = napi_set_named_property(env, ret, "VALUE_MAX_SIZE", value_max_size);
+    errcheckd();
+
     compressor = libdeflate_alloc_compressor(USED_COMPRESSION_LEVEL);
     if (compressor == NULL) {
         napi_throw_error(env, nullptr, "Could not allocate compressor: malloc() failed");
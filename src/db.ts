@@ -1,14 +1,74 @@
 const internal = require('../build/Release/instant_db_internals');
 
+/** An index file and the data files that hold its large chunk bodies. */
+export interface DBFiles {
+    storage_file: string;
+    data_files?: string[];
+}
+
+export type DBAdvice = 'normal'|'random'|'sequential'|'willneed';
+
 export interface DBOptions {
     storage_file: string;
-    storage_copies: string[];
-    read_only_files: string[];
+    storage_copies: (string|DBFiles)[];
+    read_only_files: (string|DBFiles)[];
     size: number;
+    /** Key values larger than 4 KiB by the BLAKE3 hash of their content, as for smaller ones. */
+    content_addressing?: boolean;
+    /** Recheck hashes of decompressed data in fetch()/get(): all of them, or one chunk in verify_sample. */
+    verify?: 'none'|'full'|'sampled';
+    verify_sample?: number;
+    /** Threads used to hash large values, default: one per core. */
+    threads?: number;
+    /**
+     * Split layout: chunk bodies that do not fit inline go to these files, filled in order,
+     * and storage_file keeps only the index, arrays and small chunks.
+     */
+    data_files?: string[];
+    /** Size of each new data file, default: size. */
+    data_size?: number;
+    /** mlock() the index of storage_file and read_only_files. */
+    pin_index?: boolean;
+    /** Readahead policy of each tier; the index defaults to the kernel's, data files to 'random'. */
+    index_advice?: DBAdvice;
+    data_advice?: DBAdvice;
 }
 
 export type DBValue = Buffer|Uint8Array|string;
 
+/** Largest value store(), storeMany() and set() accept, about 64 MiB. */
+export const DB_VALUE_MAX_SIZE: number = internal.VALUE_MAX_SIZE;
+
+/** 'zlib' is what HTTP calls `Content-Encoding: deflate` */
+export type DBCompressedFormat = 'zlib'|'gzip';
+
+function toBuffer(data: DBValue): Buffer
+{
+    if (data instanceof Buffer) {
+        return data;
+    } else if (
+        typeof data === 'string' || data?.buffer instanceof ArrayBuffer) {
+        return Buffer.from(data);
+    } else {
+        return Buffer.from(String(data));
+    }
+}
+
+function fileList(paths?: string[]): Buffer
+{
+    return Buffer.from(`${paths?.length}\x00${paths?.join('\0')}\x000\x00`);
+}
+
+function storagePath(files: string|DBFiles): string
+{
+    return typeof files === 'string' ? files : files.storage_file;
+}
+
+function dataFiles(files: string|DBFiles): Buffer
+{
+    return fileList(typeof files === 'string' ? [] : files.data_files ?? []);
+}
+
 export class DB {
     private _db: any;
 
@@ -16,33 +76,46 @@ export class DB {
     {
         this._db = internal.db_init({
             ...opts,
-            __copies : Buffer.from(
-                `${opts.storage_copies?.length}\x00${opts.storage_copies?.join('\0')}\x000\x00`),
-            __rocopies : Buffer.from(
-                `${
-                    opts.read_only_files?.length}\x00${opts.read_only_files?.join('\0')}\x000\x00`),
+            __copies : fileList(opts.storage_copies?.map(storagePath)),
+            __rocopies : fileList(opts.read_only_files?.map(storagePath)),
+            __data : fileList(opts.data_files ?? []),
+            __copies_data : (opts.storage_copies ?? []).map(dataFiles),
+            __rocopies_data : (opts.read_only_files ?? []).map(dataFiles),
         });
     }
 
     store(data: DBValue): string
     {
-        if (data instanceof Buffer) {
-            data = data;
-        } else if (
-            typeof data === 'string' || data?.buffer instanceof ArrayBuffer) {
-            data = Buffer.from(data);
-        } else {
-            data = Buffer.from(String(data));
-        }
+        data = toBuffer(data);
         if (!data.length) {
             return '';
         }
         return this._db.store(data);
     }
 
-    fetch(hash: string, decompress = true): Buffer|undefined
+    /**
+     * Hashes and compresses on `jobs` threads (default: one per core),
+     * then appends in order. Resolves to the hashes, in input order.
+     */
+    storeMany(data: DBValue[], jobs = 0): Promise<string[]>
+    {
+        return this._db.store_many(data.map(toBuffer), Number(jobs) || 0);
+    }
+
+    has(hash: string): boolean
+    {
+        return this._db.has(String(hash));
+    }
+
+    /** BLAKE3 of data; the key store() returns for it in content addressing mode. */
+    hash(data: DBValue): string
     {
-        return this._db.fetch(String(hash), Boolean(decompress), false);
+        return this._db.hash(toBuffer(data));
+    }
+
+    fetch(hash: string, decompress = true, format: DBCompressedFormat = 'zlib'): Buffer|undefined
+    {
+        return this._db.fetch(String(hash), Boolean(decompress), false, format);
     }
 
     fetchBuffer(hash: string): Buffer|undefined
@@ -50,9 +123,16 @@ export class DB {
         return this.fetch(hash, true);
     }
 
-    fetchCompressed(hash: string): Buffer|undefined
+    /** Served from the stored chunks as they are, without recompression. */
+    fetchCompressed(hash: string, format: DBCompressedFormat = 'zlib'): Buffer|undefined
+    {
+        return this.fetch(hash, false, format);
+    }
+
+    /** The zlib stream of every chunk, in order; the buffers map the database file. */
+    fetchChunks(hash: string): Buffer[]|undefined
     {
-        return this.fetch(hash, false);
+        return this._db.fetch(String(hash), false, false, 'chunks');
     }
 
     fetchString(hash: string): string
@@ -60,12 +140,17 @@ export class DB {
         return String(this.fetchBuffer(hash));
     }
 
-    get(key: DBValue, decompress = true): Buffer|undefined
+    get(key: DBValue, decompress = true, format: DBCompressedFormat = 'zlib'): Buffer|undefined
+    {
+        return this._db.fetch(this.key(key), Boolean(decompress), true, format);
+    }
+
+    private key(key: DBValue): string
     {
         if (typeof key !== 'string' || !key.match(/^[a-f0-9]{64}$/i)) {
             key = this.store(key);
         }
-        return this._db.fetch(key, Boolean(decompress), true);
+        return key;
     }
 
     getBuffer(key: DBValue): Buffer|undefined
@@ -73,9 +158,14 @@ export class DB {
         return this.get(key, true);
     }
 
-    getCompressed(key: DBValue): Buffer|undefined
+    getCompressed(key: DBValue, format: DBCompressedFormat = 'zlib'): Buffer|undefined
+    {
+        return this.get(key, false, format);
+    }
+
+    getChunks(key: DBValue): Buffer[]|undefined
     {
-        return this.get(key, false);
+        return this._db.fetch(this.key(key), false, true, 'chunks');
     }
 
     getString(key: DBValue): string